@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Turn a frame dumped by an XCVR_FRAME_MONITOR build into a PBM image.
+
+Usage: frame2pbm.py capture.txt frame.pbm [--compare golden.pbm]
+
+The capture is whatever came over serial after sending "FRM"; the last frame in it is used.
+Its data is in the SSD1306 page layout: 8 pages of 128 columns, one byte per column with the
+top pixel in bit 0. With --compare the image is also checked against a known good one, the
+pixels that differ are counted and the exit status is 1 if there are any.
+"""
+import sys
+
+WIDTH, HEIGHT = 128, 64
+
+
+def last_frame(lines):
+    frame, data = None, None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("FRM END"):
+            if data is not None:
+                frame = data
+            data = None
+        elif line.startswith("FRM "):
+            data = bytearray()
+        elif data is not None:
+            data.extend(bytes.fromhex(line))
+    return frame
+
+
+def pixels(frame):
+    image = [[0] * WIDTH for _ in range(HEIGHT)]
+    for index, value in enumerate(frame[:WIDTH * HEIGHT // 8]):
+        page, x = divmod(index, WIDTH)
+        for bit in range(8):
+            image[page * 8 + bit][x] = (value >> bit) & 1
+    return image
+
+
+def write_pbm(image, path):
+    with open(path, "w") as out:
+        out.write("P1\n%d %d\n" % (WIDTH, HEIGHT))
+        for row in image:
+            out.write(" ".join(str(p) for p in row) + "\n")
+
+
+def read_pbm(path):
+    with open(path) as source:
+        tokens = [t for line in source if not line.startswith("#") for t in line.split()]
+    if tokens[0] != "P1":
+        sys.exit("%s: only plain PBM (P1) is supported" % path)
+    width, height = int(tokens[1]), int(tokens[2])
+    values = "".join(tokens[3:])
+    return [[int(values[y * width + x]) for x in range(width)] for y in range(height)]
+
+
+def main():
+    args = [a for a in sys.argv[1:] if not a.startswith("--")]
+    golden = None
+    if "--compare" in sys.argv:
+        golden = sys.argv[sys.argv.index("--compare") + 1]
+        args.remove(golden)
+    if len(args) < 2:
+        sys.exit(__doc__)
+
+    with open(args[0], errors="replace") as capture:
+        frame = last_frame(capture)
+    if frame is None:
+        sys.exit("%s: no complete frame found" % args[0])
+    image = pixels(frame)
+    write_pbm(image, args[1])
+
+    if golden is not None:
+        expected = read_pbm(golden)
+        different = sum(1 for y in range(HEIGHT) for x in range(WIDTH)
+                        if y >= len(expected) or x >= len(expected[y]) or expected[y][x] != image[y][x])
+        print("%d pixels differ" % different)
+        sys.exit(1 if different else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+// Checks that the 32 bit frequencies of XCVR_FREQUENCY_32BIT give the same synth outputs as the
+// default 64 bit ones, through the arithmetic in xcvr_frequency.h.
+//
+// Usage: g++ -std=c++11 -I. -o frequency_test tools/frequency_test.cpp && ./frequency_test
+//
+// Every band of the three region plans is tuned across from BAND_TRACKING_HYSTERESIS below its
+// lower edge to as far above its upper edge with every tuning step, up and down, the way
+// Xcvr::incrementFrequency() adds the steps to the frequency. At each frequency the transmit and
+// receive VFO are computed with RIT off and on at several offsets, and the band edges themselves
+// also with every RIT offset. The BFO pair is computed for both sidebands at every pitch the
+// keyer allows. Both widths have to write bit-identical values to the Si5351. The exit status is
+// 1 on any mismatch.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <xcvr_frequency.h>
+
+// freq_t on AVR with XCVR_FREQUENCY_32BIT (unsigned long), and without
+typedef uint32_t narrow_t;
+typedef long long wide_t;
+
+// as in xcvr.h and xcvr.cpp
+#define BAND_TRACKING_HYSTERESIS 5000UL
+#define SIDETONE_HZ_LOW_LIMIT 299
+#define SIDETONE_HZ_HIGH_LIMIT 2001
+#define IF_CENTER_FREQUENCY 9000000UL
+#define IF_BANDWIDTH 500
+
+static const long stepSizes[] = {10, 100, 1000, 10000};
+
+// bandPlan, in KHz, for regions 1, 2 and 3
+static const unsigned short bandEdges[][2] = {
+  {1810, 2000}, {3500, 3800}, {7000, 7200},
+  {1800, 2000}, {3500, 4000}, {7000, 7300},
+  {1800, 2000}, {3500, 3900}, {7000, 7200},
+  {10100, 10150}, {14000, 14350}, {18068, 18168}, {21000, 21450}, {24890, 24990}, {28000, 29700}
+};
+
+static const short ritAmounts[] = {-32768, -9999, -1000, -320, -10, 0, 10, 320, 1000, 9999, 32767};
+#define RIT_AMOUNTS (sizeof(ritAmounts) / sizeof(ritAmounts[0]))
+
+static unsigned long cases = 0, mismatches = 0;
+
+static void compare(const char* what, long long frequency, short ritAmount, bool ritOn,
+                    unsigned long long narrow, unsigned long long wide) {
+  cases++;
+  if (narrow != wide) {
+    mismatches++;
+    printf("%s at %lld Hz rit %d%s: 32 bit %llu, 64 bit %llu\n",
+           what, frequency, ritAmount, ritOn ? "" : " (off)", narrow, wide);
+  }
+}
+
+// Xcvr::updateVfoFrequencies()
+static void checkVfo(narrow_t narrow, wide_t wide, bool ritOn, short ritAmount) {
+  compare("transmit VFO", wide, ritAmount, ritOn,
+          synthFrequency(mixVfoFrequency(narrow, (narrow_t) IF_CENTER_FREQUENCY)),
+          synthFrequency(mixVfoFrequency(wide, (wide_t) IF_CENTER_FREQUENCY)));
+  compare("receive VFO", wide, ritAmount, ritOn,
+          synthFrequency(mixVfoFrequency(ritFrequency(narrow, ritOn, ritAmount), (narrow_t) IF_CENTER_FREQUENCY)),
+          synthFrequency(mixVfoFrequency(ritFrequency(wide, ritOn, ritAmount), (wide_t) IF_CENTER_FREQUENCY)));
+}
+
+// Xcvr::recalculateBfo()
+static void checkBfo() {
+  for (unsigned short pitch = SIDETONE_HZ_LOW_LIMIT + 1; pitch < SIDETONE_HZ_HIGH_LIMIT; pitch++) {
+    for (int upper = 0; upper <= 1; upper++) {
+      narrow_t narrowReceive, narrowTransmit;
+      wide_t wideReceive, wideTransmit;
+      bfoFrequencies((narrow_t) IF_CENTER_FREQUENCY, IF_BANDWIDTH, pitch, upper,
+                     narrowReceive, narrowTransmit);
+      bfoFrequencies((wide_t) IF_CENTER_FREQUENCY, IF_BANDWIDTH, pitch, upper,
+                     wideReceive, wideTransmit);
+      compare(upper ? "USB receive BFO" : "LSB receive BFO", pitch, 0, false,
+              synthFrequency(narrowReceive), synthFrequency(wideReceive));
+      compare(upper ? "USB transmit BFO" : "LSB transmit BFO", pitch, 0, false,
+              synthFrequency(narrowTransmit), synthFrequency(wideTransmit));
+    }
+  }
+}
+
+static void checkBand(unsigned long low, unsigned long high) {
+  unsigned long edges[] = {low - BAND_TRACKING_HYSTERESIS, low, high, high + BAND_TRACKING_HYSTERESIS};
+  for (unsigned e = 0; e < sizeof(edges) / sizeof(edges[0]); e++) {
+    for (unsigned r = 0; r < RIT_AMOUNTS; r++) {
+      checkVfo(edges[e], edges[e], true, ritAmounts[r]);
+      checkVfo(edges[e], edges[e], false, ritAmounts[r]);
+    }
+  }
+
+  for (unsigned s = 0; s < sizeof(stepSizes) / sizeof(stepSizes[0]); s++) {
+    for (int direction = -1; direction <= 1; direction += 2) {
+      long amount = direction * stepSizes[s];
+      narrow_t narrow = direction > 0 ? edges[0] : edges[3];
+      wide_t wide = narrow;
+      for (unsigned i = 0; wide >= (wide_t) edges[0] && wide <= (wide_t) edges[3]; i++) {
+        short ritAmount = ritAmounts[i % RIT_AMOUNTS];
+        checkVfo(narrow, wide, true, ritAmount);
+        checkVfo(narrow, wide, false, ritAmount);
+        // Xcvr::incrementFrequency()
+        narrow += amount;
+        wide += amount;
+      }
+    }
+  }
+}
+
+int main() {
+  for (unsigned b = 0; b < sizeof(bandEdges) / sizeof(bandEdges[0]); b++) {
+    checkBand(bandEdges[b][0] * 1000UL, bandEdges[b][1] * 1000UL);
+  }
+  checkBfo();
+  printf("%lu cases, %lu mismatches\n", cases, mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Pre-render digit glyphs from xcvr_fonts.h into SSD1306 page-aligned column bitmaps.
+
+Usage: gen_glyphs.py [xcvr_fonts.h] > xcvr_glyphs.h
+
+A glyph is placed exactly where u8glib's drawStr() would put it for the given baseline. The
+cells it covers are emitted one page (8 rows, LSB on top) after the other, one byte per column,
+so that the UI can write a changed character straight into the display RAM.
+"""
+import re
+import sys
+
+# table name, font, baseline y passed to drawStr(), characters
+TABLES = [
+    ("frequencyGlyphs", "font_frequency", 12, "0123456789. "),
+    ("wpmGlyphs", "font_ui", 30, "0123456789"),
+    ("pitchGlyphs", "font_ui", 47, "0123456789"),
+]
+
+
+def load_fonts(path):
+    text = open(path).read()
+    fonts = {}
+    for name, body in re.findall(r"u8g_fntpgm_uint8_t\s+(\w+)\[\d+\][^=]*=\s*\{([^}]*)\}", text):
+        fonts[name] = [int(v) for v in body.replace("\n", "").split(",") if v.strip()]
+    return fonts
+
+
+def glyph(font, char):
+    """Returns (width, height, dx, x offset, y offset, rows) of a format 0 u8glib font glyph."""
+    assert font[0] == 0, "only u8glib format 0 fonts are supported"
+    first, last = font[10], font[11]
+    pos = 17
+    for encoding in range(first, last + 1):
+        if font[pos] == 255:
+            if encoding == ord(char):
+                raise ValueError("glyph %r is missing from the font" % char)
+            pos += 1
+            continue
+        w, h, size, dx, xo, yo = font[pos:pos + 6]
+        yo = yo - 256 if yo > 127 else yo
+        xo = xo - 256 if xo > 127 else xo
+        data = font[pos + 6:pos + 6 + size]
+        if encoding == ord(char):
+            stride = (w + 7) // 8
+            rows = [data[r * stride:(r + 1) * stride] for r in range(h)]
+            return w, h, dx, xo, yo, rows
+        pos += 6 + size
+    raise ValueError("glyph %r is outside of the font" % char)
+
+
+def render(font, char, baseline):
+    """Returns {(x, y)} of the pixels drawStr(0, baseline, char) sets, and the glyph's dx."""
+    w, h, dx, xo, yo, rows = glyph(font, char)
+    bottom = baseline - yo - 1
+    pixels = set()
+    for r, row in enumerate(rows):
+        for c in range(w):
+            if row[c // 8] & (0x80 >> (c % 8)):
+                pixels.add((xo + c, bottom - h + 1 + r))
+    return pixels, dx
+
+
+def main():
+    fonts = load_fonts(sys.argv[1] if len(sys.argv) > 1 else "xcvr_fonts.h")
+    out = ["// Generated by tools/gen_glyphs.py from xcvr_fonts.h, do not edit.", "",
+           "#ifndef xcvr_glyphs_h_", "#define xcvr_glyphs_h_", ""]
+    for name, font_name, baseline, chars in TABLES:
+        rendered = [render(fonts[font_name], c, baseline) for c in chars]
+        width = rendered[0][1]
+        assert all(dx == width for _, dx in rendered), "%s is not monospaced" % name
+        rows = [y for pixels, _ in rendered for _, y in pixels]
+        first_page, last_page = min(rows) // 8, max(rows) // 8
+        pages = last_page - first_page + 1
+
+        macro = re.sub(r"([a-z])([A-Z])", r"\1_\2", name).upper()
+        out.append("// %s at baseline %d: %r" % (font_name, baseline, chars))
+        out.append("#define %s_WIDTH %d" % (macro, width))
+        out.append("#define %s_FIRST_PAGE %d" % (macro, first_page))
+        out.append("#define %s_PAGES %d" % (macro, pages))
+        out.append("static const byte %s[%d][%d] PROGMEM = {" % (name, len(chars), pages * width))
+        for char, (pixels, _) in zip(chars, rendered):
+            assert all(0 <= x < width for x, _ in pixels), "%r spills out of its cell" % char
+            columns = []
+            for page in range(first_page, last_page + 1):
+                for x in range(width):
+                    bits = sum(1 << (y - page * 8) for px, y in pixels if px == x and y // 8 == page)
+                    columns.append("0x%02X" % bits)
+            out.append("  {%s}, // %r" % (", ".join(columns), char))
+        out.append("};")
+        out.append("")
+    out.append("#endif")
+    print("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
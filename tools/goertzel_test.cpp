@@ -0,0 +1,114 @@
+// Runs synthetic sample streams through the audio meter's Goertzel arithmetic in xcvr_goertzel.h.
+//
+// Usage: g++ -std=c++11 -I. -o goertzel_test tools/goertzel_test.cpp && ./goertzel_test
+//
+// For every pitch the meter offers, tones every 50 Hz from METER_OFFSET_HZ below to above it are
+// fed in as ADC readings, from full scale down to a few ADC steps and at several phases. The
+// filter nearest the tone has to come out strongest and the 16 bit state must never wrap. Tones
+// further out are not checked: a block is 150 Hz wide, 300 Hz off the pitch every filter has a
+// null. goertzel_product() is also compared with the plain C arithmetic on random numbers.
+// The exit status is 1 on any failure.
+
+#include <math.h>
+#include <stdio.h>
+#include <xcvr_goertzel.h>
+
+// as in xcvr.h
+#define METER_SAMPLE_RATE 9615
+#define METER_BLOCK_SIZE 64
+#define METER_OFFSET_HZ 150
+#define METER_FILTERS 3
+#define METER_AT_PITCH 1
+
+static unsigned failures = 0;
+
+static void fail(const char* what, int pitch, int tone, int amplitude, int phase) {
+  failures++;
+  printf("pitch %d tone %d amplitude %d phase %d: %s\n", pitch, tone, amplitude, phase, what);
+}
+
+// AudioMeter::setPitch()
+static short coefficient(double frequency) {
+  return 2.0 * cos(2.0 * M_PI * frequency / METER_SAMPLE_RATE) * (1 << METER_COEFFICIENT_BITS);
+}
+
+static void checkProduct() {
+  unsigned seed = 1;
+  for (long i = 0; i < 1000000; i++) {
+    seed = seed * 1103515245 + 12345;
+    short c = (short) (seed >> 8);
+    seed = seed * 1103515245 + 12345;
+    short s = (short) (seed >> 8);
+    if (goertzel_product(c, s) != (short) (((long) c * s) >> METER_COEFFICIENT_BITS)) {
+      failures++;
+      printf("goertzel_product(%d, %d) is %d\n", c, s, goertzel_product(c, s));
+    }
+  }
+}
+
+// one block of a tone, returns the index of the strongest filter
+static int strongest(int pitch, int tone, int amplitude, int phase, bool& wrapped) {
+  short coefficients[METER_FILTERS];
+  short s1[METER_FILTERS] = {0}, s2[METER_FILTERS] = {0};
+  long wide1[METER_FILTERS] = {0}, wide2[METER_FILTERS] = {0};
+  for (int i = 0; i < METER_FILTERS; i++) {
+    coefficients[i] = coefficient(pitch + (i - METER_AT_PITCH) * METER_OFFSET_HZ);
+  }
+
+  wrapped = false;
+  for (int n = 0; n < METER_BLOCK_SIZE; n++) {
+    double angle = 2.0 * M_PI * tone * n / METER_SAMPLE_RATE + phase * M_PI / 4;
+    long value = lround(512 + amplitude * sin(angle));
+    value = value < 0 ? 0 : value > 1023 ? 1023 : value;
+    short x = goertzel_input(value);
+    for (int i = 0; i < METER_FILTERS; i++) {
+      goertzel_step(coefficients[i], x, s1[i], s2[i]);
+      long s = x + (((long) coefficients[i] * wide1[i]) >> METER_COEFFICIENT_BITS) - wide2[i];
+      wide2[i] = wide1[i];
+      wide1[i] = s;
+      if (s != s1[i]) {
+        wrapped = true;
+      }
+    }
+  }
+
+  int best = 0;
+  long bestPower = -1;
+  for (int i = 0; i < METER_FILTERS; i++) {
+    long power = goertzel_power(coefficients[i], s1[i], s2[i]);
+    if (power > bestPower) {
+      best = i;
+      bestPower = power;
+    }
+  }
+  return best;
+}
+
+int main() {
+  checkProduct();
+
+  // below 16 ADC steps the input, scaled down by 8, is one or two steps and the meter shows no signal
+  static const int amplitudes[] = {511, 256, 128, 64, 32, 16};
+  unsigned cases = 0;
+  for (int pitch = 300; pitch <= 2000; pitch += 10) {
+    for (int offset = -METER_OFFSET_HZ; offset <= METER_OFFSET_HZ; offset += 50) {
+      int tone = pitch + offset;
+      int expected = offset < -METER_OFFSET_HZ / 2 ? 0 : offset > METER_OFFSET_HZ / 2 ? 2 : METER_AT_PITCH;
+      for (unsigned a = 0; a < sizeof(amplitudes) / sizeof(amplitudes[0]); a++) {
+        for (int phase = 0; phase < 8; phase++) {
+          bool wrapped;
+          int best = strongest(pitch, tone, amplitudes[a], phase, wrapped);
+          cases++;
+          if (wrapped) {
+            fail("16 bit state wrapped", pitch, tone, amplitudes[a], phase);
+          }
+          if (best != expected) {
+            fail("wrong filter strongest", pitch, tone, amplitudes[a], phase);
+          }
+        }
+      }
+    }
+  }
+  printf("%u streams, %u failures\n", cases, failures);
+  return failures ? 1 : 0;
+}
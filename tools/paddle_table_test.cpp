@@ -0,0 +1,168 @@
+// Checks the ULTIMATIC transition table in xcvr_paddles.h against the nested switch it replaced.
+//
+// Usage: g++ -std=c++11 -I. -o paddle_table_test tools/paddle_table_test.cpp && ./paddle_table_test
+//
+// Every keyer mode, ultimatic mode, last closure and dit and dah buffer value is run through both
+// and the resulting closure and buffers compared. The exit status is 1 on any mismatch.
+
+#include <stdio.h>
+#include <xcvr_paddles.h>
+
+typedef unsigned char byte;
+
+#define STRAIGHT 1
+#define TUNING 6
+#define ULTIMATIC 5
+
+struct PaddleState {
+  byte closure;
+  byte dit_buffer;
+  byte dah_buffer;
+};
+
+// Keyer::check_paddles() before the table, after the paddles were read
+static void reference(byte keyer_mode, byte ultimatic_mode, PaddleState& p) {
+  byte& last_closure = p.closure;
+  byte& dit_buffer = p.dit_buffer;
+  byte& dah_buffer = p.dah_buffer;
+
+  if (keyer_mode == ULTIMATIC) {
+    if (ultimatic_mode == ULTIMATIC_NORMAL) {
+      switch (last_closure) {
+        case DIT_CLOSURE_DAH_OFF:
+          if (dah_buffer) {
+            if (dit_buffer) {
+              last_closure = DAH_CLOSURE_DIT_ON;
+              dit_buffer = 0;
+            } else {
+              last_closure = DAH_CLOSURE_DIT_OFF;
+            }
+          } else {
+            if (!dit_buffer) {
+              last_closure = NO_CLOSURE;
+            }
+          }
+          break;
+        case DIT_CLOSURE_DAH_ON:
+          if (dit_buffer) {
+            if (dah_buffer) {
+              dah_buffer = 0;
+            } else {
+              last_closure = DIT_CLOSURE_DAH_OFF;
+            }
+          } else {
+            if (dah_buffer) {
+              last_closure = DAH_CLOSURE_DIT_OFF;
+            } else {
+              last_closure = NO_CLOSURE;
+            }
+          }
+          break;
+
+        case DAH_CLOSURE_DIT_OFF:
+          if (dit_buffer) {
+            if (dah_buffer) {
+              last_closure = DIT_CLOSURE_DAH_ON;
+              dah_buffer = 0;
+            } else {
+              last_closure = DIT_CLOSURE_DAH_OFF;
+            }
+          } else {
+            if (!dah_buffer) {
+              last_closure = NO_CLOSURE;
+            }
+          }
+          break;
+
+        case DAH_CLOSURE_DIT_ON:
+          if (dah_buffer) {
+            if (dit_buffer) {
+              dit_buffer = 0;
+            } else {
+              last_closure = DAH_CLOSURE_DIT_OFF;
+            }
+          } else {
+            if (dit_buffer) {
+              last_closure = DIT_CLOSURE_DAH_OFF;
+            } else {
+              last_closure = NO_CLOSURE;
+            }
+          }
+          break;
+
+        case NO_CLOSURE:
+          if ((dit_buffer) && (!dah_buffer)) {
+            last_closure = DIT_CLOSURE_DAH_OFF;
+          } else {
+            if ((dah_buffer) && (!dit_buffer)) {
+              last_closure = DAH_CLOSURE_DIT_OFF;
+            } else {
+              if ((dit_buffer) && (dah_buffer)) {
+                // need to handle dit/dah priority here
+                last_closure = DIT_CLOSURE_DAH_ON;
+                dah_buffer = 0;
+              }
+            }
+          }
+          break;
+      }
+    } else {
+     if ((dit_buffer) && (dah_buffer)) {   // dit or dah priority mode
+       if (ultimatic_mode == ULTIMATIC_DIT_PRIORITY) {
+         dah_buffer = 0;
+       } else {
+         dit_buffer = 0;
+       }
+     }
+    }
+  }
+}
+
+static const byte ultimatic_transitions[ULTIMATIC_MODES][CLOSURE_STATES * 4] = {
+  ULTIMATIC_TABLE(ULTIMATIC_NORMAL),
+  ULTIMATIC_TABLE(ULTIMATIC_DIT_PRIORITY),
+  ULTIMATIC_TABLE(ULTIMATIC_DAH_PRIORITY)
+};
+
+// Keyer::check_paddles() now, after the paddles were read
+static void table(byte keyer_mode, byte ultimatic_mode, PaddleState& p) {
+  if (keyer_mode == ULTIMATIC) {
+    byte transition = ultimatic_transitions[ultimatic_mode][CLOSURE_INDEX(p.closure, p.dit_buffer != 0, p.dah_buffer != 0)];
+    p.closure = transition & CLOSURE_STATE_MASK;
+    if (transition & CLOSURE_CLEAR_DIT) {
+      p.dit_buffer = 0;
+    }
+    if (transition & CLOSURE_CLEAR_DAH) {
+      p.dah_buffer = 0;
+    }
+  }
+}
+
+int main() {
+  unsigned cases = 0, mismatches = 0;
+  for (byte keyer_mode = STRAIGHT; keyer_mode <= TUNING; keyer_mode++) {
+    for (byte ultimatic_mode = 0; ultimatic_mode < ULTIMATIC_MODES; ultimatic_mode++) {
+      for (byte closure = 0; closure < CLOSURE_STATES; closure++) {
+        for (byte dit = 0; dit <= 2; dit++) {
+          for (byte dah = 0; dah <= 2; dah++) {
+            PaddleState expected = {closure, dit, dah};
+            PaddleState actual = expected;
+            reference(keyer_mode, ultimatic_mode, expected);
+            table(keyer_mode, ultimatic_mode, actual);
+            cases++;
+            if (expected.closure != actual.closure || expected.dit_buffer != actual.dit_buffer ||
+                expected.dah_buffer != actual.dah_buffer) {
+              mismatches++;
+              printf("mode %d ultimatic %d closure %d dit %d dah %d: expected %d %d %d, got %d %d %d\n",
+                     keyer_mode, ultimatic_mode, closure, dit, dah,
+                     expected.closure, expected.dit_buffer, expected.dah_buffer,
+                     actual.closure, actual.dit_buffer, actual.dah_buffer);
+            }
+          }
+        }
+      }
+    }
+  }
+  printf("%u cases, %u mismatches\n", cases, mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Break the static RAM of a firmware build down by subsystem.
+
+Usage: ram_report.py firmware.elf [--symbols] [--nm avr-nm]
+
+Every .data and .bss symbol is put into the subsystem its name matches first and the totals
+are printed per subsystem, with each symbol's size as well when --symbols is given. The
+stack and heap share whatever is left of the ATmega328's 2048 bytes; send "RAM" to a build
+with XCVR_RAM_REPORT set to 1 to see how much of that the stack really needs.
+"""
+import re
+import subprocess
+import sys
+
+RAM_SIZE = 2048
+
+SUBSYSTEMS = [
+    ("display", r"u8g|U8G|xcvrDisplay|display|uiText"),
+    ("input", r"encoder|Encoder|InputQueue|ButtonSampler|Gesture"),
+    ("state", r"radioState|RadioState"),
+    ("memories", r"MemoryStore"),
+    ("stats", r"OperatingStats"),
+    ("keyer", r"keyer|Keyer|ultimatic"),
+    ("xcvr", r"xcvr|Xcvr|transceiver|si5351|Si5351|mcp|MCP23017|Wire|twi_"),
+    ("instrumentation", r"Profiler|Trace|KeyerBenchmark|probe"),
+    ("serial", r"Serial|rx_buffer|tx_buffer"),
+    ("core", r"timer0_|Timer1|__malloc|__brkval|__flp|tone"),
+]
+
+
+def symbols(elf, nm):
+    output = subprocess.run([nm, "-S", "-C", "--size-sort", elf],
+                            check=True, capture_output=True, text=True).stdout
+    for line in output.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) < 4:
+            continue
+        size, kind, name = int(fields[1], 16), fields[2], fields[3]
+        if kind in "dD":
+            yield name, ".data", size
+        elif kind in "bB":
+            yield name, ".bss", size
+
+
+def subsystem(name):
+    for subsystem_name, pattern in SUBSYSTEMS:
+        if re.search(pattern, name):
+            return subsystem_name
+    return "other"
+
+
+def main():
+    args = [a for a in sys.argv[1:] if not a.startswith("--")]
+    if len(args) < 1:
+        sys.exit(__doc__)
+    nm = "avr-nm"
+    if "--nm" in sys.argv:
+        nm = sys.argv[sys.argv.index("--nm") + 1]
+        args.remove(nm)
+    show_symbols = "--symbols" in sys.argv
+
+    totals, members = {}, {}
+    for name, section, size in symbols(args[0], nm):
+        group = subsystem(name)
+        data, bss = totals.get(group, (0, 0))
+        totals[group] = (data + size, bss) if section == ".data" else (data, bss + size)
+        members.setdefault(group, []).append((size, section, name))
+
+    print("%-16s %6s %6s %6s" % ("subsystem", ".data", ".bss", "total"))
+    all_data = all_bss = 0
+    for group in sorted(totals, key=lambda g: -sum(totals[g])):
+        data, bss = totals[group]
+        all_data += data
+        all_bss += bss
+        print("%-16s %6d %6d %6d" % (group, data, bss, data + bss))
+        if show_symbols:
+            for size, section, name in sorted(members[group], reverse=True):
+                print("    %6d %-5s %s" % (size, section, name))
+    print("%-16s %6d %6d %6d" % ("static", all_data, all_bss, all_data + all_bss))
+    print("%-16s %20d" % ("heap and stack", RAM_SIZE - all_data - all_bss))
+
+
+if __name__ == "__main__":
+    main()
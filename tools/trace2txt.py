@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Decode a serial capture taken with XCVR_TRACE into one text line per record.
+
+Usage: trace2txt.py capture.bin [--inputs] > capture.txt
+
+Text status lines found in between the records are passed through prefixed with '#'.
+With --inputs only the input records are written back out, as a binary trace that can
+be streamed to a TRACE_REPLAY build. Diff the text output of two firmware versions
+to see what changed in their behavior and timing.
+"""
+import sys
+
+SYNC = 0x1E
+ENCODER, SYNTH = 0x01, 0x12
+PAYLOAD = (ENCODER, SYNTH)
+NAMES = {
+    0x01: "ENC", 0x02: "BTN", 0x03: "MODE", 0x04: "DIT", 0x05: "DAH",
+    0x10: "KEY", 0x11: "PTT", 0x12: "SYNTH", 0x13: "FRAME",
+}
+
+
+def records(data):
+    i, text = 0, bytearray()
+    while i < len(data):
+        if data[i] != SYNC:
+            text.append(data[i])
+            i += 1
+            continue
+        if text:
+            yield None, bytes(text)
+            text = bytearray()
+        length = 9 if i + 1 < len(data) and data[i + 1] in PAYLOAD else 5
+        if i + length > len(data):
+            break
+        yield data[i:i + length], None
+        i += length
+    if text:
+        yield None, bytes(text)
+
+
+def main():
+    data = open(sys.argv[1], "rb").read()
+    inputs_only = "--inputs" in sys.argv
+    now = last_input = 0
+    for record, text in records(data):
+        if record is not None:
+            now += record[3] | (record[4] << 8)
+        if inputs_only:
+            if record is not None and record[1] < 0x10:
+                delta = min(now - last_input, 0xFFFF)
+                sys.stdout.buffer.write(bytes([SYNC, record[1], record[2], delta & 0xFF, delta >> 8]) + record[5:])
+                last_input = now
+            continue
+        if text is not None:
+            for line in text.decode("ascii", "replace").splitlines():
+                if line.strip():
+                    print("# " + line)
+            continue
+        kind, value = record[1], record[2]
+        if kind == ENCODER:
+            value = int.from_bytes(record[5:9], "little", signed=True)
+        line = "%10d %-5s %d" % (now, NAMES.get(kind, hex(kind)), value)
+        if kind == SYNTH:
+            line += " %d" % int.from_bytes(record[5:9], "little")
+        print(line)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,187 +1,1282 @@
 #include <xcvr.h>
 #include <xcvr_fonts.h>
+#include <xcvr_glyphs.h>
 
 XcvrUi::XcvrUi() {
 }
 
-ClickEncoder* XcvrUi::encoder;
+// Long lived objects are placed statically, so that their RAM shows up in .bss at build time.
+ClickEncoder XcvrUi::encoder(A1, A0, A2);
+static U8GLIB xcvrDisplay; // initialized by XcvrUi::init(), not at construction
 Xcvr* transceiver;
-void timerIsr() {
-    XcvrUi::encoder->service();
+RadioStateStore radioState;
+
+static ButtonSampler modeButtonSampler(8, TRACE_MODE_BUTTON);
+static ButtonSampler encoderButtonSampler(A2, TRACE_ENCODER_BUTTON);
+
+#if XCVR_ADAPTIVE_ENCODER || XCVR_IDLE_SLEEP
+
+static volatile byte encoderRate = ENCODER_RATE_ACTIVE;
+static byte encoderQuietTicks = 0;
+
+// from the timer interrupt, the pin change interrupts or with interrupts off
+static void setEncoderRate(byte rate) {
+    static const unsigned int periods[] = {
+        ENCODER_ACTIVE_PERIOD_MICROSECONDS, ENCODER_RESTING_PERIOD_MICROSECONDS, ENCODER_IDLE_PERIOD_MICROSECONDS
+    };
+    encoderRate = rate;
+    encoderQuietTicks = 0;
+    Timer1.setPeriod(periods[rate]);
+    if (rate == ENCODER_RATE_ACTIVE) {
+        Timer1.restart(); // the counter may be past the new period, it would take a wrap around
+    }
+}
+
+// the first edge on the encoder or a button puts the encoder service back to full rate
+static void wakeInputs() {
+    if (encoderRate != ENCODER_RATE_ACTIVE) {
+        setEncoderRate(ENCODER_RATE_ACTIVE);
+    }
+}
+
+ISR(PCINT0_vect) {
+    wakeInputs();
+}
+
+ISR(PCINT1_vect) {
+    wakeInputs();
+}
+
+#if XCVR_IDLE_SLEEP
+// the paddles only wake the loop, the keyer polls them and has no use for the encoder service
+ISR(PCINT2_vect) {
+}
+#endif
+
+static void enableWakePins() {
+    PCMSK0 |= _BV(PCINT0); // D8, mode button
+    PCMSK1 |= _BV(PCINT8) | _BV(PCINT9) | _BV(PCINT10); // A0..A2, encoder and its button
+    PCIFR = _BV(PCIF0) | _BV(PCIF1);
+    PCICR |= _BV(PCIE0) | _BV(PCIE1);
+#if XCVR_IDLE_SLEEP
+    PCMSK2 |= _BV(PCINT19) | _BV(PCINT20); // D3, D4, paddles
+    PCIFR = _BV(PCIF2);
+    PCICR |= _BV(PCIE2);
+#endif
+}
+
+#endif
+
+// ClickEncoder::getValue() ends with sei(), which would let the pin change interrupts into the
+// timer interrupt half way: they are held back until it returns, and interrupts go off again.
+// The library keeps the delta private, so it cannot be read around getValue().
+static short readEncoderDelta() {
+    byte pinChangeInterrupts = PCICR;
+    PCICR = 0;
+    short delta = XcvrUi::encoder.getValue();
+    cli();
+    PCICR = pinChangeInterrupts;
+    return delta;
 }
 
-Bounce modeDebouncer = Bounce();
+static void serviceInputs() {
+#if XCVR_TRACE == TRACE_REPLAY
+    return; // the trace stands in for the controls and nothing drains the input queue
+#endif
+    XcvrUi::encoder.service();
+
+    modeButtonSampler.sample();
+    encoderButtonSampler.sample();
+
+    if (InputQueue::full()) {
+        // leave the movement in the encoder, it is picked up once there is room again
+        InputQueue::overflows++;
+        return;
+    }
+    short delta = readEncoderDelta();
+    if (delta != 0) {
+        InputQueue::push(TRACE_ENCODER_DELTA, delta);
+    }
+
+#if XCVR_ADAPTIVE_ENCODER
+    if (delta != 0 || !modeButtonSampler.released() || !encoderButtonSampler.released()) {
+        encoderQuietTicks = 0;
+    } else if (encoderRate == ENCODER_RATE_ACTIVE && ++encoderQuietTicks >= ENCODER_QUIET_TICKS) {
+        setEncoderRate(ENCODER_RATE_RESTING);
+    }
+#endif
+}
+
+void timerIsr() {
+#if XCVR_PROFILING
+    unsigned long start = profilerNow();
+    serviceInputs();
+    unsigned long elapsed = profilerNow() - start;
+    PROFILE_RECORD(PROBE_TIMER_ISR, elapsed);
+    Profiler::interruptMicros += elapsed;
+#else
+    serviceInputs();
+#endif
+}
 
 static unsigned long lastUiUpdate = 0;
+static bool displayAsleep = false; // sleepOn() was sent and no refresh since
+#if XCVR_STATS
+static bool loopBusy = false; // the loop drew the display or saved the statistics
+#endif
 static unsigned long lastStatusAdvertiseTime = 0;
 #define INACTIVITY_MILLISECONDS_UNTIL_SLEEPING 300 * 1000
 #define ADVERTISE_INTERVAL_MILLISECONDS 5 * 1000
 
+#if XCVR_DISPLAY_HW_SPI
+
+// Hardware SPI transport for u8glib. Bytes are queued and the SPI transfer complete interrupt
+// sends them one after the other, so drawing the next page overlaps with sending this one.
+// The SSD1306 has no chip select wired, switching between commands and data or deselecting
+// waits for the queue to drain.
+
+extern "C" uint8_t u8g_dev_ssd1306_128x64_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg);
+
+static volatile byte displayQueue[DISPLAY_QUEUE_SIZE];
+static volatile byte displayQueueHead = 0;
+static volatile byte displayQueueTail = 0;
+static volatile bool displaySpiBusy = false;
+
+ISR(SPI_STC_vect) {
+    if (displayQueueTail != displayQueueHead) {
+        SPDR = displayQueue[displayQueueTail];
+        displayQueueTail = (displayQueueTail + 1) & (DISPLAY_QUEUE_SIZE - 1);
+    } else {
+        displaySpiBusy = false;
+    }
+}
+
+static void displayQueueByte(byte value) {
+    byte next = (displayQueueHead + 1) & (DISPLAY_QUEUE_SIZE - 1);
+    while (next == displayQueueTail); // full, wait for the interrupt to make room
+
+    byte sreg = SREG;
+    cli();
+    if (displaySpiBusy) {
+        displayQueue[displayQueueHead] = value;
+        displayQueueHead = next;
+    } else {
+        displaySpiBusy = true;
+        SPDR = value;
+    }
+    SREG = sreg;
+}
+
+static void displayWaitIdle() {
+    while (displaySpiBusy);
+}
+
+static uint8_t displayComFn(u8g_t *u8g, uint8_t msg, uint8_t arg_val, void *arg_ptr) {
+    switch (msg) {
+        case U8G_COM_MSG_INIT:
+            pinMode(13, OUTPUT); // SCK
+            pinMode(11, OUTPUT); // MOSI
+            pinMode(DISPLAY_RESET_PIN, OUTPUT); // also SS, which has to be an output to stay SPI master
+            pinMode(DISPLAY_DC_PIN, OUTPUT);
+            SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPIE) | _BV(SPR0); // mode 0, MSB first
+            SPSR = _BV(SPI2X); // F_CPU / 8
+            break;
+        case U8G_COM_MSG_RESET:
+            displayWaitIdle();
+            digitalWrite(DISPLAY_RESET_PIN, arg_val);
+            break;
+        case U8G_COM_MSG_CHIP_SELECT:
+            if (arg_val == 0) {
+                displayWaitIdle();
+            }
+            break;
+        case U8G_COM_MSG_ADDRESS:
+            displayWaitIdle();
+            digitalWrite(DISPLAY_DC_PIN, arg_val ? HIGH : LOW);
+            break;
+        case U8G_COM_MSG_WRITE_BYTE:
+            displayQueueByte(arg_val);
+            break;
+        case U8G_COM_MSG_WRITE_SEQ: {
+            uint8_t *data = (uint8_t *) arg_ptr;
+            while (arg_val-- > 0) {
+                displayQueueByte(*data++);
+            }
+            break;
+        }
+        case U8G_COM_MSG_WRITE_SEQ_P: {
+            u8g_pgm_uint8_t *data = (u8g_pgm_uint8_t *) arg_ptr;
+            while (arg_val-- > 0) {
+                displayQueueByte(u8g_pgm_read(data++));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return 1;
+}
+
+U8G_PB_DEV(xcvrDisplayDevice, 128, 64, 8, u8g_dev_ssd1306_128x64_fn, displayComFn);
+
+#endif
+
+// Input helper, so that a replayed trace can stand in for the real controls.
+
+static bool readInputEvent(InputEvent& event) {
+#if XCVR_TRACE == TRACE_REPLAY
+    Trace::service();
+    byte level;
+    if (Trace::takeModeButtonEdge(level)) {
+        event.type = TRACE_MODE_BUTTON;
+        event.value = level;
+        return true;
+    }
+    if (Trace::takeEncoderButtonEdge(level)) {
+        event.type = TRACE_ENCODER_BUTTON;
+        event.value = level;
+        return true;
+    }
+    short delta = Trace::takeEncoderDelta();
+    if (delta != 0) {
+        event.type = TRACE_ENCODER_DELTA;
+        event.value = delta;
+        return true;
+    }
+    return false;
+#else
+    if (!InputQueue::pop(event)) {
+        return false;
+    }
+    TRACE_INPUT(event.type, event.value);
+    return true;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
+RadioState& RadioStateStore::edit() {
+    RadioState& back = buffers[front ^ 1];
+    back = buffers[front];
+    return back;
+}
+
+void RadioStateStore::publish(unsigned short fields) {
+    unsigned short sequence = published + 1;
+    for (byte i = 0; i < STATE_FIELD_COUNT; i++) {
+        if (fields & STATE_BIT(i)) {
+            fieldSequences[i] = sequence;
+        }
+    }
+    front ^= 1;
+    published = sequence;
+}
+
+unsigned short RadioStateStore::read(RadioState& state) {
+    unsigned short sequence;
+    do {
+        sequence = published;
+        state = buffers[front];
+    } while (sequence != published);
+    return sequence;
+}
+
+unsigned short RadioStateStore::changedSince(unsigned short sequence) {
+    unsigned short changed = 0;
+    for (byte i = 0; i < STATE_FIELD_COUNT; i++) {
+        // wrap around safe, as long as no consumer falls 32768 publishes behind
+        if ((short) (fieldSequences[i] - sequence) > 0) {
+            changed |= STATE_BIT(i);
+        }
+    }
+    return changed;
+}
+
+// -----------------------------------------------------------------------------
+
+byte MemoryStore::occupancy[(MEMORY_CHANNELS + 7) / 8];
+
+#define MEMORY_RECORD_ADDRESS(channel) ((channel) * MEMORY_RECORD_SIZE)
+
+void MemoryStore::init() {
+    unsigned short magic;
+    EEPROM.get(MEMORY_EEPROM_HEADER, magic);
+    if (magic != MEMORY_MAGIC) {
+        // a blank or foreign EEPROM reads as full of channels, start from an empty one instead
+        memset(occupancy, 0, sizeof(occupancy));
+        EEPROM.put(MEMORY_EEPROM_HEADER + 2, occupancy);
+        EEPROM.put(MEMORY_EEPROM_HEADER, (unsigned short) MEMORY_MAGIC);
+        return;
+    }
+    EEPROM.get(MEMORY_EEPROM_HEADER + 2, occupancy);
+}
+
+bool MemoryStore::read(byte channel, MemoryChannel& memory) {
+    if (channel >= MEMORY_CHANNELS || !occupied(channel)) {
+        return false;
+    }
+    int address = MEMORY_RECORD_ADDRESS(channel);
+    unsigned long packed;
+    EEPROM.get(address, packed);
+    EEPROM.get(address + 4, memory.ritAmount);
+    for (byte i = 0; i < MEMORY_LABEL_LENGTH; i++) {
+        memory.label[i] = EEPROM.read(address + 6 + i);
+    }
+    memory.label[MEMORY_LABEL_LENGTH] = '\0';
+
+    memory.frequency = packed & MEMORY_FREQUENCY_MASK;
+    memory.sideband = (packed >> MEMORY_SIDEBAND_BIT) & 1;
+    memory.filterIndex = (packed >> MEMORY_FILTER_SHIFT) & 3;
+    memory.ritOn = (packed >> MEMORY_RIT_ON_BIT) & 1;
+    return true;
+}
+
+void MemoryStore::write(byte channel, const MemoryChannel& memory) {
+    if (channel >= MEMORY_CHANNELS) {
+        return;
+    }
+    unsigned long packed = (memory.frequency & MEMORY_FREQUENCY_MASK)
+                           | ((unsigned long) (memory.sideband & 1) << MEMORY_SIDEBAND_BIT)
+                           | ((unsigned long) (memory.filterIndex & 3) << MEMORY_FILTER_SHIFT)
+                           | ((unsigned long) memory.ritOn << MEMORY_RIT_ON_BIT);
+
+    // put() only writes the bytes that differ, which spares the EEPROM when a channel is rewritten
+    int address = MEMORY_RECORD_ADDRESS(channel);
+    EEPROM.put(address, packed);
+    EEPROM.put(address + 4, memory.ritAmount);
+    for (byte i = 0; i < MEMORY_LABEL_LENGTH; i++) {
+        EEPROM.update(address + 6 + i, memory.label[i]);
+    }
+
+    occupancy[channel >> 3] |= 1 << (channel & 7);
+    writeOccupancy(channel);
+}
+
+void MemoryStore::erase(byte channel) {
+    if (channel >= MEMORY_CHANNELS) {
+        return;
+    }
+    occupancy[channel >> 3] &= ~(1 << (channel & 7));
+    writeOccupancy(channel);
+}
+
+void MemoryStore::writeOccupancy(byte channel) {
+    EEPROM.update(MEMORY_EEPROM_HEADER + 2 + (channel >> 3), occupancy[channel >> 3]);
+}
+
+// Steps through the channels from the one after from, skipping empty bytes of the occupancy
+// bits whole. from itself comes last, so a single stored channel is found from anywhere.
+byte MemoryStore::next(byte from, char direction) {
+    byte channel = from;
+    for (byte visited = 0; visited < MEMORY_CHANNELS; visited++) {
+        if (direction > 0) {
+            channel = channel >= MEMORY_CHANNELS - 1 ? 0 : channel + 1;
+        } else {
+            channel = (channel == 0 || channel >= MEMORY_CHANNELS) ? MEMORY_CHANNELS - 1 : channel - 1;
+        }
+
+        if (occupancy[channel >> 3] == 0) {
+            // on to the last channel of the byte in this direction
+            if (direction > 0) {
+                byte last = min(channel | 7, MEMORY_CHANNELS - 1);
+                visited += last - channel;
+                channel = last;
+            } else {
+                visited += channel & 7;
+                channel &= ~7;
+            }
+        } else if (occupied(channel)) {
+            return channel;
+        }
+    }
+    return NO_MEMORY;
+}
+
+byte MemoryStore::firstFree() {
+    for (byte i = 0; i < sizeof(occupancy); i++) {
+        if (occupancy[i] == 0xFF) {
+            continue;
+        }
+        for (byte bit = 0; bit < 8; bit++) {
+            byte channel = (i << 3) + bit;
+            if (channel < MEMORY_CHANNELS && !occupied(channel)) {
+                return channel;
+            }
+        }
+    }
+    return NO_MEMORY;
+}
+
+// -----------------------------------------------------------------------------
+
+#if XCVR_STATS
+
+unsigned long OperatingStats::counters[STAT_COUNT];
+
+static const char statNames[] PROGMEM =
+    "txms keys ptt chars_straight chars_iambic_b chars_iambic_a chars_bug chars_ultimatic chars_tuning "
+    "bands steps synth mcp overruns";
+
+void OperatingStats::init() {
+    unsigned short magic;
+    EEPROM.get(STATS_EEPROM_BASE, magic);
+    if (magic != STATS_MAGIC) {
+        clear();
+        return;
+    }
+    EEPROM.get(STATS_EEPROM_BASE + 2, counters);
+}
+
+void OperatingStats::save() {
+    // put() only writes the bytes that differ, most counters do not move between two saves
+    EEPROM.put(STATS_EEPROM_BASE + 2, counters);
+    EEPROM.put(STATS_EEPROM_BASE, (unsigned short) STATS_MAGIC);
+}
+
+void OperatingStats::clear() {
+    memset(counters, 0, sizeof(counters));
+    save();
+}
+
+void OperatingStats::dump() {
+    char buffer[12];
+    const char* name = statNames;
+    Serial.print(F("STA"));
+    for (byte i = 0; i < STAT_COUNT; i++) {
+        Serial.write(' ');
+        char c;
+        while ((c = pgm_read_byte(name++)) != ' ' && c != '\0') {
+            Serial.write(c);
+        }
+        Serial.write('=');
+        Serial.write(ultoa(counters[i], buffer, 10));
+    }
+    Serial.print(F("\n"));
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+
+#if XCVR_BUS_ACCOUNTING
+
+BusMonitor::Account BusMonitor::accounts[BUS_OPERATION_COUNT];
+byte BusMonitor::current = BUS_OPERATION_COUNT;
+freq_t BusMonitor::clocks[3];
+unsigned short BusMonitor::pins = BUS_PINS_UNKNOWN;
+unsigned int BusMonitor::failedChecks = 0;
+byte BusMonitor::lastFailed = BUS_OPERATION_COUNT;
+
+static const char busOperationNames[] PROGMEM = "KEY UNKEY TUNE RIT BAND SIDEBAND PITCH RECALL OTHER";
+
+// operations call one another, the writes are accounted to the outermost one
+void BusMonitor::begin(byte operation) {
+    if (current == BUS_OPERATION_COUNT) {
+        current = operation;
+        accounts[operation].count++;
+    }
+}
+
+void BusMonitor::end(byte operation) {
+    if (current == operation) {
+        current = BUS_OPERATION_COUNT;
+        check(operation);
+    }
+}
+
+void BusMonitor::synthWrite(byte clock, freq_t frequency, unsigned long elapsed) {
+    Account& account = accounts[current == BUS_OPERATION_COUNT ? BUS_OTHER : current];
+    account.synthWrites++;
+    account.estimatedBytes += BUS_SYNTH_WRITE_BYTES;
+    account.micros += elapsed;
+    if (clock < 3) {
+        clocks[clock] = frequency;
+    }
+}
+
+void BusMonitor::expanderWrite(unsigned short pins, unsigned long elapsed) {
+    Account& account = accounts[current == BUS_OPERATION_COUNT ? BUS_OTHER : current];
+    account.expanderWrites++;
+    account.estimatedBytes += BUS_EXPANDER_WRITE_BYTES;
+    account.micros += elapsed;
+    BusMonitor::pins = pins;
+}
+
+void BusMonitor::check(byte operation) {
+    bool transmitting = transceiver->inTransmitMode;
+    freq_t vfo = transmitting ? transceiver->transmitVfoFrequency : transceiver->receiveVfoFrequency;
+    freq_t bfo = transmitting ? transceiver->transmitBfoFrequency : transceiver->receiveBfoFrequency;
+    unsigned short bandPins = pgm_read_word(&bandPlan[transceiver->bandIndex].expanderMask);
+    if ((clocks[SI5351_CLK0] != 0 && clocks[SI5351_CLK0] != vfo)
+        || (clocks[SI5351_CLK2] != 0 && clocks[SI5351_CLK2] != bfo)
+        || (pins != BUS_PINS_UNKNOWN && pins != bandPins)) {
+        failedChecks++;
+        lastFailed = operation;
+    }
+}
+
+static void writeBusOperationName(byte operation) {
+    const char* name = busOperationNames;
+    for (byte i = 0; i < operation; name++) {
+        if (pgm_read_byte(name) == ' ') {
+            i++;
+        }
+    }
+    char c;
+    while ((c = pgm_read_byte(name++)) != ' ' && c != '\0') {
+        Serial.write(c);
+    }
+}
+
+void BusMonitor::dump() {
+    char buffer[12];
+    for (byte i = 0; i < BUS_OPERATION_COUNT; i++) {
+        Account& account = accounts[i];
+        Serial.print(F("BUS "));
+        writeBusOperationName(i);
+        Serial.print(F(" N"));
+        Serial.write(utoa(account.count, buffer, 10));
+        Serial.print(F(" SYN"));
+        Serial.write(utoa(account.synthWrites, buffer, 10));
+        Serial.print(F(" MCP"));
+        Serial.write(utoa(account.expanderWrites, buffer, 10));
+        Serial.print(F(" ESTB"));
+        Serial.write(ultoa(account.estimatedBytes, buffer, 10));
+        Serial.print(F(" US"));
+        Serial.write(ultoa(account.micros, buffer, 10));
+        Serial.print(F("\n"));
+    }
+
+    Serial.print(F("BUS LAST CLK0="));
+    Serial.write(ultoa(clocks[SI5351_CLK0], buffer, 10));
+    Serial.print(F(" CLK2="));
+    Serial.write(ultoa(clocks[SI5351_CLK2], buffer, 10));
+    Serial.print(F(" GPIO="));
+    Serial.write(utoa(pins, buffer, 16));
+    Serial.print(F(" FAILED"));
+    Serial.write(utoa(failedChecks, buffer, 10));
+    if (failedChecks != 0) {
+        Serial.write(' ');
+        writeBusOperationName(lastFailed);
+    }
+    Serial.print(F("\n"));
+}
+
+void BusMonitor::reset() {
+    memset(accounts, 0, sizeof(accounts));
+    failedChecks = 0;
+    lastFailed = BUS_OPERATION_COUNT;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+
+#if XCVR_FRAME_MONITOR
+
+u8g_com_fnptr FrameMonitor::forward;
+bool FrameMonitor::inFrame = false;
+bool FrameMonitor::dumping = false;
+bool FrameMonitor::dataMode = false;
+unsigned short FrameMonitor::sums[FRAME_PAGES];
+unsigned short FrameMonitor::lastSums[FRAME_PAGES];
+unsigned int FrameMonitor::dataBytes = 0;
+unsigned int FrameMonitor::frameBytes = 0;
+byte FrameMonitor::draws = 0;
+unsigned int FrameMonitor::lastBytes = 0;
+byte FrameMonitor::lastDraws = 0;
+byte FrameMonitor::lastChangedPages = 0;
+unsigned long FrameMonitor::frames = 0;
+unsigned long FrameMonitor::totalBytes = 0;
+unsigned long FrameMonitor::unchangedBytes = 0;
+unsigned long FrameMonitor::blitBytes = 0;
+
+void FrameMonitor::install(u8g_t* u8g) {
+    forward = u8g->dev->com_fn;
+    u8g->dev->com_fn = com;
+}
+
+void FrameMonitor::begin(bool dumping) {
+    inFrame = true;
+    FrameMonitor::dumping = dumping;
+    dataBytes = 0;
+    frameBytes = 0;
+    draws = 0;
+    memset(sums, 0, sizeof(sums));
+    if (dumping) {
+        Serial.print(F("FRM 128 64\n"));
+    }
+}
+
+void FrameMonitor::end() {
+    inFrame = false;
+    if (dumping) {
+        dumping = false;
+        Serial.print(F("FRM END\n"));
+        return; // the same frame again, it says nothing about rendering
+    }
+
+    byte changed = 0;
+    for (byte page = 0; page < FRAME_PAGES; page++) {
+        if (frames == 0 || sums[page] != lastSums[page]) {
+            changed++;
+        } else {
+            unchangedBytes += FRAME_PAGE_BYTES;
+        }
+        lastSums[page] = sums[page];
+    }
+    lastChangedPages = changed;
+    lastBytes = frameBytes;
+    lastDraws = draws;
+    totalBytes += frameBytes;
+    frames++;
+}
+
+// Fletcher-16 style, it tells a page apart from the one before that had a pixel moved
+void FrameMonitor::data(byte value) {
+    if (inFrame) {
+        byte page = dataBytes / FRAME_PAGE_BYTES;
+        if (page < FRAME_PAGES) {
+            byte sum = sums[page] + value;
+            sums[page] = ((unsigned short) ((sums[page] >> 8) + sum) << 8) | sum;
+        }
+        dataBytes++;
+        if (dumping) {
+            static const char hex[] = "0123456789ABCDEF";
+            Serial.write(hex[value >> 4]);
+            Serial.write(hex[value & 0x0F]);
+            if ((dataBytes % 32) == 0) {
+                Serial.write('\n');
+            }
+        }
+    }
+}
+
+uint8_t FrameMonitor::com(u8g_t* u8g, uint8_t msg, uint8_t arg_val, void* arg_ptr) {
+    switch (msg) {
+        case U8G_COM_MSG_ADDRESS:
+            dataMode = arg_val != 0;
+            break;
+        case U8G_COM_MSG_WRITE_BYTE:
+            if (dataMode) {
+                data(arg_val);
+            }
+            if (inFrame) {
+                frameBytes++;
+            } else {
+                blitBytes++;
+            }
+            break;
+        case U8G_COM_MSG_WRITE_SEQ:
+        case U8G_COM_MSG_WRITE_SEQ_P:
+            if (dataMode) {
+                for (byte i = 0; i < arg_val; i++) {
+                    data(msg == U8G_COM_MSG_WRITE_SEQ ? ((uint8_t*) arg_ptr)[i] : u8g_pgm_read((u8g_pgm_uint8_t*) arg_ptr + i));
+                }
+            }
+            if (inFrame) {
+                frameBytes += arg_val;
+            } else {
+                blitBytes += arg_val;
+            }
+            break;
+        default:
+            break;
+    }
+    return forward(u8g, msg, arg_val, arg_ptr);
+}
+
+void FrameMonitor::dump() {
+    char buffer[12];
+    Serial.print(F("FRS N"));
+    Serial.write(ultoa(frames, buffer, 10));
+    Serial.print(F(" B"));
+    Serial.write(utoa(lastBytes, buffer, 10));
+    Serial.print(F(" D"));
+    Serial.write(utoa(lastDraws, buffer, 10));
+    Serial.print(F(" CHG"));
+    Serial.write(utoa(lastChangedPages, buffer, 10));
+    Serial.print(F(" TOTB"));
+    Serial.write(ultoa(totalBytes, buffer, 10));
+    Serial.print(F(" SAME"));
+    Serial.write(ultoa(unchangedBytes, buffer, 10));
+    Serial.print(F(" BLIT"));
+    Serial.write(ultoa(blitBytes, buffer, 10));
+    Serial.print(F("\n"));
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+
+volatile InputEvent InputQueue::events[INPUT_QUEUE_SIZE];
+volatile byte InputQueue::head = 0;
+volatile byte InputQueue::tail = 0;
+volatile unsigned short InputQueue::overflows = 0;
+volatile unsigned short InputQueue::dropped = 0;
+volatile byte InputQueue::highWater = 0;
+
+bool InputQueue::push(byte type, short value) {
+    byte next = (head + 1) & (INPUT_QUEUE_SIZE - 1);
+    if (next == tail) {
+        return false;
+    }
+    events[head].type = type;
+    events[head].value = value;
+    head = next; // publish only once the event is complete
+
+    byte used = (head - tail) & (INPUT_QUEUE_SIZE - 1);
+    if (used > highWater) {
+        highWater = used;
+    }
+    return true;
+}
+
+bool InputQueue::pop(InputEvent& event) {
+    byte current = tail;
+    if (current == head) {
+        return false;
+    }
+    event.type = events[current].type;
+    event.value = events[current].value;
+    tail = (current + 1) & (INPUT_QUEUE_SIZE - 1);
+    return true;
+}
+
+void InputQueue::dump() {
+    char buffer[8];
+    noInterrupts();
+    unsigned short overflowCount = overflows;
+    unsigned short droppedCount = dropped;
+    byte highWaterMark = highWater;
+    interrupts();
+
+    Serial.print(F("EVQ overflows="));
+    Serial.write(ltoa(overflowCount, buffer, 10));
+    Serial.print(F(" dropped="));
+    Serial.write(ltoa(droppedCount, buffer, 10));
+    Serial.print(F(" highwater="));
+    Serial.write(itoa(highWaterMark, buffer, 10));
+    Serial.print(F("/"));
+    Serial.write(itoa(INPUT_QUEUE_SIZE - 1, buffer, 10));
+    Serial.print(F("\n"));
+}
+
+void InputQueue::reset() {
+    noInterrupts();
+    overflows = 0;
+    dropped = 0;
+    highWater = 0;
+    interrupts();
+}
+
+void ButtonSampler::sample() {
+    byte level = (*input & mask) ? HIGH : LOW;
+    if (level != lastRead) {
+        lastRead = level;
+        count = 0;
+    } else if (count < INPUT_DEBOUNCE_MILLISECONDS) {
+        count++;
+        if (count == INPUT_DEBOUNCE_MILLISECONDS && level != stableLevel) {
+            stableLevel = level;
+            if (stableLevel == queuedLevel) {
+                // went back before the previous edge could be queued, the press is lost
+                InputQueue::dropped++;
+            }
+        }
+    }
+
+    if (stableLevel != queuedLevel) {
+        if (InputQueue::push(eventType, stableLevel)) {
+            queuedLevel = stableLevel;
+        } else {
+            InputQueue::overflows++;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GestureRecognizer::press(unsigned long now) {
+    if (state != GESTURE_STATE_WAITING) {
+        clicks = 0;
+    }
+    state = GESTURE_STATE_DOWN;
+    since = now;
+    turned = 0;
+}
+
+void GestureRecognizer::release(unsigned long now) {
+    if (state == GESTURE_STATE_DOWN) {
+        clicks++;
+        if (clicks == 2) {
+            pending = GESTURE_DOUBLE_CLICK;
+            state = GESTURE_STATE_IDLE;
+        } else {
+            state = GESTURE_STATE_WAITING;
+            since = now;
+        }
+    } else {
+        // a hold is only reported now, so that it never comes before a long hold or a hold+turn
+        if (state == GESTURE_STATE_HELD) {
+            pending = GESTURE_HOLD;
+        }
+        state = GESTURE_STATE_IDLE;
+    }
+}
+
+bool GestureRecognizer::turn(short amount) {
+    if (state == GESTURE_STATE_IDLE || state == GESTURE_STATE_WAITING) {
+        return false;
+    }
+    state = GESTURE_STATE_TURNED;
+    turned += amount;
+    pending = GESTURE_HOLD_TURN;
+    return true;
+}
+
+byte GestureRecognizer::poll(unsigned long now) {
+    switch (state) {
+        case GESTURE_STATE_DOWN:
+            if (now - since >= GESTURE_HOLD_MILLISECONDS) {
+                state = GESTURE_STATE_HELD;
+            }
+            break;
+        case GESTURE_STATE_HELD:
+            if (now - since >= GESTURE_LONG_HOLD_MILLISECONDS) {
+                state = GESTURE_STATE_LONG_HELD;
+                pending = GESTURE_LONG_HOLD;
+            }
+            break;
+        case GESTURE_STATE_WAITING:
+            if (now - since >= GESTURE_DOUBLE_CLICK_MILLISECONDS) {
+                state = GESTURE_STATE_IDLE;
+                pending = GESTURE_CLICK;
+            }
+            break;
+        default:
+            break;
+    }
+
+    byte gesture = pending;
+    pending = GESTURE_NONE;
+    lastTurned = turned;
+    turned = 0;
+    return gesture;
+}
+
+// -----------------------------------------------------------------------------
 
 void XcvrUi::init(Xcvr& xcvr, Keyer& keyer) {
     this->xcvr = &xcvr;
     this->keyer = &keyer;
     this->keyer->configuration.hz_sidetone = this->xcvr->cwPitch;
 
-    display = new U8GLIB_SSD1306_128X64(13, 12, 0, 11, 10); // CS is not used
-    encoder = new ClickEncoder(A1, A0, A2);
-
-    Timer1.initialize(1000);
+    display = &xcvrDisplay;
+#if XCVR_DISPLAY_HW_SPI
+    u8g_Init(display->getU8g(), &xcvrDisplayDevice);
+#else
+    u8g_InitSPI(display->getU8g(), &u8g_dev_ssd1306_128x64_sw_spi, 13, 12, 0, 11, 10); // CS is not used
+#endif
+#if XCVR_FRAME_MONITOR
+    FrameMonitor::install(display->getU8g());
+#endif
+    drawn.valid = false;
+    MemoryStore::init();
+#if XCVR_STATS
+    OperatingStats::init();
+#endif
+#if XCVR_AUDIO_METER
+    AudioMeter::init(this->xcvr->cwPitch);
+#endif
+
+    Timer1.initialize(ENCODER_ACTIVE_PERIOD_MICROSECONDS);
     Timer1.attachInterrupt(timerIsr);
+#if XCVR_ADAPTIVE_ENCODER || XCVR_IDLE_SLEEP
+    enableWakePins();
+#endif
 
-
-
-    // initialize UI mode button
+    // initialize UI mode button, it is sampled by timerIsr() from now on
     pinMode(8, INPUT);
     digitalWrite(8, HIGH); // enable pull-up
-    modeDebouncer.attach(8);
-    modeDebouncer.interval(5);
 }
 
 void XcvrUi::update() {
+#if XCVR_PROFILING
+    static unsigned long lastUpdate = 0;
+    unsigned long updateStart = profilerNow();
+    if (lastUpdate != 0) {
+        PROFILE_RECORD(PROBE_LOOP, updateStart - lastUpdate);
+    }
+    lastUpdate = updateStart;
+#endif
+    PROFILE_SCOPE(PROBE_UI_UPDATE);
 
-    // check if button state changed
-    if (modeDebouncer.update()) {
-        if (modeDebouncer.read() == LOW) {
-            mode++;
-            if (mode == SETTING_RIT && !xcvr->isRitOn()) {
-                mode++;
-            }
-            mode %= LAST_MODE;
+    serviceSerial();
 
-            switch (mode) {
-                case SETTING_SPEED:
-                    keyer->key_tx = 0;
-                    break;
-                default:
-                    keyer->key_tx = 1;
-                    break;
+    unsigned long now = millis();
+#if XCVR_STATS
+    // the last loop, if the keyer was idle when it started and it had nothing to draw, save or send
+    static unsigned long lastUpdateTime = 0;
+    static unsigned long lastKeyUpTime = 0;
+    static bool lastLoopIdle = false;
+    bool sent = keyer->key_state || keyer->key_up_time != lastKeyUpTime;
+    if (lastLoopIdle && !loopBusy && !sent && (now - lastUpdateTime) > LOOP_OVERRUN_MILLISECONDS) {
+        STATS_COUNT(STAT_LOOP_OVERRUNS);
+    }
+    lastUpdateTime = now;
+    lastKeyUpTime = keyer->key_up_time;
+    lastLoopIdle = keyer->idle_window();
+    loopBusy = false;
+#endif
+
+    // events are handled in the order they happened, a turn has to land before or after
+    // the button edges around it
+    InputEvent event;
+    while (readInputEvent(event)) {
+        handleInput(event, now);
+    }
+
+    // poll() sets the turn amount, so it has to be called first
+    byte gesture = modeButton.poll(now);
+    handleModeButton(gesture, modeButton.turnAmount());
+    gesture = encoderButton.poll(now);
+    handleEncoderButton(gesture, encoderButton.turnAmount());
+
+    serviceScan(now);
+
+    if (radioState.sequence() != shownSequence) {
+        if (!changePending) {
+            changePending = true;
+            changePendingSince = now;
+        }
+        if (keyer->idle_window() || (now - changePendingSince) >= DISPLAY_MAX_STALENESS_MILLISECONDS) {
+            refresh(now);
+        }
+    } else if (keyer->idle_window()) {
+        if ((now - lastUiUpdate) > INACTIVITY_MILLISECONDS_UNTIL_SLEEPING) {
+            if (!displayAsleep) {
+                display->sleepOn();
+                displayAsleep = true;
             }
+#if XCVR_IDLE_SLEEP
+            idleSleep();
+#endif
+        }
+        if ((now - lastStatusAdvertiseTime) > ADVERTISE_INTERVAL_MILLISECONDS) {
+            advertiseStatus();
+        }
+#if XCVR_STATS
+        static unsigned long lastStatsSave = 0;
+        if ((now - lastStatsSave) > STATS_SAVE_INTERVAL_MILLISECONDS) {
+            OperatingStats::save();
+            lastStatsSave = now;
+            loopBusy = true;
+        }
+#endif
+    }
+
+#if XCVR_AUDIO_METER
+    updateMeter(now);
+#endif
+}
+
+#if XCVR_IDLE_SLEEP
+
+// Sleeps until the next interrupt, a millisecond at the most because of the millis() tick.
+void XcvrUi::idleSleep() {
+    if (encoderRate != ENCODER_RATE_IDLE) {
+        cli();
+        setEncoderRate(ENCODER_RATE_IDLE);
+        sei();
+    }
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+}
+
+#endif
+
+// what the status line and the display show of the radio state
+#define ADVERTISED_FIELDS (STATE_BIT(STATE_FREQUENCY) | STATE_BIT(STATE_RIT) | STATE_BIT(STATE_SIDEBAND) \
+                           | STATE_BIT(STATE_BAND) | STATE_BIT(STATE_CW_PITCH) | STATE_BIT(STATE_WPM))
+#define DRAWN_FIELDS (STATE_BIT(STATE_FREQUENCY) | STATE_BIT(STATE_RIT) | STATE_BIT(STATE_BAND) \
+                      | STATE_BIT(STATE_CW_PITCH) | STATE_BIT(STATE_WPM) | STATE_BIT(STATE_KEYER_MODE) \
+                      | STATE_BIT(STATE_UI))
 
-            xcvr->statusChanged = true;
+void XcvrUi::refresh(unsigned long now) {
+    unsigned short seen = shownSequence;
+    shownSequence = radioState.read(shown);
+    unsigned short changed = radioState.changedSince(seen);
+
+    lastUiUpdate = now;
+    if (changed & ADVERTISED_FIELDS) {
+        advertiseStatus();
+    }
+#if XCVR_AUDIO_METER
+    if (changed & STATE_BIT(STATE_CW_PITCH)) {
+        AudioMeter::setPitch(shown.cwPitch);
+    }
+#endif
+    if (displayAsleep) {
+        display->sleepOff();
+        displayAsleep = false;
+    }
+    if (!drawn.valid || (changed & DRAWN_FIELDS)) {
+        if (!blitChanges(changed)) {
+            render();
         }
+#if XCVR_STATS
+        loopBusy = true;
+#endif
     }
+    PROFILE_RECORD(PROBE_DISPLAY_STALENESS, (millis() - changePendingSince) * 1000);
+    changePending = false;
+}
 
+// The texts are drawn one after the other, so they all share one buffer: the render*() helpers
+// write into it and whoever called them uses it before the next one does.
+static char uiText[11];
 
-    currentEncoderValue += encoder->getValue();
-    bool encoderChanged = currentEncoderValue != lastEncoderValue;
+void XcvrUi::render() {
+    PROFILE_SCOPE(PROBE_RENDER);
+    FRAME_BEGIN(false);
+    display->firstPage();
+    do {
+        draw();
+        FRAME_DRAWN();
+    } while (display->nextPage());
+    FRAME_END();
+    TRACE_OUTPUT(TRACE_FRAME, 0);
+#if XCVR_AUDIO_METER
+    meter.drawnValid = false; // a full frame clears it
+#endif
+
+    renderFrequency();
+    memcpy(drawn.frequency, uiText, sizeof(drawn.frequency));
+    renderWpm();
+    memcpy(drawn.wpm, uiText, sizeof(drawn.wpm));
+    renderPitch();
+    memcpy(drawn.pitch, uiText, sizeof(drawn.pitch));
+    drawn.valid = true;
+}
+
+// Writes the characters that changed since the last full render straight into the display RAM,
+// using the pre-rendered glyphs. Falls back to a full render (returns false) whenever anything
+// besides the frequency, wpm and pitch digits changed or a digit moved.
+bool XcvrUi::blitChanges(unsigned short changed) {
+    if (!drawn.valid
+        || (changed & ~(STATE_BIT(STATE_FREQUENCY) | STATE_BIT(STATE_WPM) | STATE_BIT(STATE_CW_PITCH)))) {
+        return false;
+    }
+
+    // a leading space is narrower than a digit in font_ui, so the digits after it would move
+    if ((shown.wpm < 10) != (drawn.wpm[0] == ' ') || (shown.cwPitch < 1000) != (drawn.pitch[0] == ' ')) {
+        return false;
+    }
+
+    PROFILE_SCOPE(PROBE_RENDER);
+
+    // rows of the highlight box behind the digits, per page
+    static const byte noBox[2] = {0x00, 0x00};
+    static const byte speedBox[2] = {0xFE, 0xFF};
+    static const byte pitchBox[2] = {0xFC, 0xFF};
+    static const byte stepUnderline[2] = {0x00, 1 << (STEP_UNDERLINE_ROW - 8)};
+
+    byte stepDigit = stepDigitPosition();
+    renderFrequency();
+    for (byte i = 0; i < sizeof(drawn.frequency); i++) {
+        char c = uiText[i];
+        if (c != drawn.frequency[i]) {
+            byte glyph = c == '.' ? 10 : (c == ' ' ? 11 : c - '0');
+            blitGlyph(frequencyGlyphs[glyph], i * FREQUENCY_GLYPHS_WIDTH, FREQUENCY_GLYPHS_FIRST_PAGE,
+                      FREQUENCY_GLYPHS_PAGES, FREQUENCY_GLYPHS_WIDTH, i == stepDigit ? stepUnderline : noBox);
+            drawn.frequency[i] = c;
+        }
+    }
+
+    byte x = 2;
+    renderWpm();
+    for (byte i = 0; i < sizeof(drawn.wpm); i++) {
+        if (uiText[i] != drawn.wpm[i]) {
+            blitGlyph(wpmGlyphs[uiText[i] - '0'], x, WPM_GLYPHS_FIRST_PAGE, WPM_GLYPHS_PAGES,
+                      WPM_GLYPHS_WIDTH, mode == SETTING_SPEED ? speedBox : noBox);
+            drawn.wpm[i] = uiText[i];
+        }
+        x += uiText[i] == ' ' ? 3 : WPM_GLYPHS_WIDTH;
+    }
+
+    x = 82;
+    renderPitch();
+    for (byte i = 0; i < sizeof(drawn.pitch); i++) {
+        if (uiText[i] != drawn.pitch[i]) {
+            blitGlyph(pitchGlyphs[uiText[i] - '0'], x, PITCH_GLYPHS_FIRST_PAGE, PITCH_GLYPHS_PAGES,
+                      PITCH_GLYPHS_WIDTH, mode == SETTING_CW_PITCH ? pitchBox : noBox);
+            drawn.pitch[i] = uiText[i];
+        }
+        x += uiText[i] == ' ' ? 3 : PITCH_GLYPHS_WIDTH;
+    }
+    TRACE_OUTPUT(TRACE_FRAME, 1);
+
+    return true;
+}
+
+// Sends one pre-rendered character cell using the SSD1306 page addressing mode u8glib sets up.
+void XcvrUi::blitGlyph(const byte* glyph, byte x, byte firstPage, byte pages, byte width, const byte* invertMasks) {
+    byte columns[FREQUENCY_GLYPHS_WIDTH];
+
+    for (byte page = 0; page < pages; page++) {
+        for (byte column = 0; column < width; column++) {
+            columns[column] = pgm_read_byte(glyph + page * width + column) ^ invertMasks[page];
+        }
+        blitColumns(columns, x, firstPage + page, width);
+    }
+}
+
+void XcvrUi::blitColumns(const byte* columns, byte x, byte page, byte width) {
+    u8g_t* u8g = display->getU8g();
+
+    u8g_SetChipSelect(u8g, u8g->dev, 1);
+    u8g_SetAddress(u8g, u8g->dev, 0); // commands
+    u8g_WriteByte(u8g, u8g->dev, 0xB0 | page);
+    u8g_WriteByte(u8g, u8g->dev, 0x10 | (x >> 4));
+    u8g_WriteByte(u8g, u8g->dev, x & 0x0F);
+    u8g_SetAddress(u8g, u8g->dev, 1); // data
+    u8g_WriteSequence(u8g, u8g->dev, width, (uint8_t*) columns);
+    u8g_SetChipSelect(u8g, u8g->dev, 0);
+}
+
+#if XCVR_FRAME_MONITOR
+
+// The frame on display once more, with its pages going out over serial in hex as they are sent.
+void XcvrUi::dumpFrame() {
+    FRAME_BEGIN(true);
+    display->firstPage();
+    do {
+        draw();
+        FRAME_DRAWN();
+    } while (display->nextPage());
+    FRAME_END();
+}
+
+#endif
+
+#if XCVR_AUDIO_METER
+
+// Turns the latest filter powers into the meter's marker and bar and redraws them when they
+// moved, at most every METER_REFRESH_MILLISECONDS and never while keying.
+void XcvrUi::updateMeter(unsigned long now) {
+    long power[METER_FILTERS];
+    if (AudioMeter::read(power)) {
+        // fast attack, slow decay
+        if (power[METER_AT_PITCH] > meter.level) {
+            meter.level = power[METER_AT_PITCH];
+        } else {
+            meter.level -= (meter.level - power[METER_AT_PITCH]) >> 3;
+        }
 
-    if (encoderChanged) {
-        lastEncoderValue = currentEncoderValue;
-        int amountToAdd = (currentEncoderValue / 3);
-        if (amountToAdd != 0) {
-            currentEncoderValue -= amountToAdd * 3;
+        byte bits = 0;
+        for (long level = meter.level; level > 1; level >>= 1) {
+            bits++;
+        }
+        // one ADC step of noise is around 2^8, a full scale tone 2^22
+        meter.bar = bits > 8 ? min((bits - 8) * 3, METER_WIDTH) : 0;
 
-            switch (mode) {
-                case NORMAL:
-                    xcvr->incrementFrequency(amountToAdd * stepSize);
-                    break;
-                case SETTING_RIT:
-                    xcvr->ritIncrement(amountToAdd * 10);
-                    break;
-                case SETTING_SPEED:
-                    keyer->speed_change(amountToAdd);
-                    break;
-                case SETTING_KEYER_MODE:
-                    keyer->configuration.keyer_mode++;
-                    if (keyer->configuration.keyer_mode == 7) {
-                        keyer->configuration.keyer_mode = 1;
-                    }
-                    keyer->config_dirty = 1;
-                    break;
-                case SETTING_CW_PITCH:
-                    keyer->sidetone_adj(amountToAdd * 10);
-                    xcvr->setCwPitch(keyer->configuration.hz_sidetone);
-                    break;
-                case SETTING_BAND:
-                    if (amountToAdd > 0)
-                        xcvr->nextBand();
-                    else
-                        xcvr->previousBand();
-                    break;
-                default:
-                    break;
-            }
+        long total = power[METER_BELOW] + power[METER_AT_PITCH] + power[METER_ABOVE];
+        meter.signal = bits > 10;
 
+        byte blockBits = 0;
+        for (long level = power[METER_AT_PITCH]; level > 1; level >>= 1) {
+            blockBits++;
+        }
+        meter.blockSignal = blockBits > 10;
+        if (meter.blocks < 255) {
+            meter.blocks++;
+        }
+        if (meter.signal) {
+            // scale down first, the difference of two powers times 20 has to fit
+            long above = power[METER_ABOVE] >> 8;
+            long below = power[METER_BELOW] >> 8;
+            total >>= 8;
+            meter.tuning = total > 0 ? (above - below) * (METER_WIDTH / 2) / total : 0;
         }
     }
 
-    ClickEncoder::Button encoderButtonState = encoder->getButton();
-    if (encoderButtonState == ClickEncoder::Clicked) {
-        xcvr->nextBand();
-    } else if (encoderButtonState == ClickEncoder::Held) {
-        xcvr->setRit(!xcvr->isRitOn());
-        render();
-        // wait until button is released, otherwise we'll get continuous held events
-        while (encoder->getButton() != ClickEncoder::Released);
+    if (now - meter.lastDrawn < METER_REFRESH_MILLISECONDS
+        || (now - lastUiUpdate) > INACTIVITY_MILLISECONDS_UNTIL_SLEEPING
+        || !drawn.valid
+        || !keyer->idle_window()) {
+        return;
     }
+    if (meter.drawnValid && meter.drawnBar == meter.bar && meter.drawnTuning == meter.tuning
+        && meter.drawnSignal == meter.signal) {
+        return;
+    }
+    meter.lastDrawn = now;
+    blitMeter();
+}
 
-
-    unsigned long now = millis();
-    if (xcvr->hasStatusChanged() || keyer->config_dirty) {
-        lastUiUpdate = now;
-        advertiseStatus();
-        display->sleepOff();
-        render();
-    } else {
-        if ((now - lastUiUpdate) > INACTIVITY_MILLISECONDS_UNTIL_SLEEPING) {
-            display->sleepOn();
+// Bottom page, right of the feature labels: a center tick and the tuning marker on the top
+// three rows, the S-meter bar on the bottom four.
+void XcvrUi::blitMeter() {
+    byte columns[METER_WIDTH];
+    char center = METER_WIDTH / 2;
+    char marker = center + meter.tuning;
+
+    for (byte x = 0; x < METER_WIDTH; x++) {
+        byte column = 0;
+        if (x == center) {
+            column |= 0x01;
         }
-        if ((now - lastStatusAdvertiseTime) > ADVERTISE_INTERVAL_MILLISECONDS) {
-            advertiseStatus();
+        if (meter.signal && x >= marker - 1 && x <= marker + 1) {
+            column |= 0x06;
         }
+        if (x < meter.bar) {
+            column |= 0xF0;
+        }
+        columns[x] = column;
     }
-}
+    blitColumns(columns, METER_X, METER_PAGE, METER_WIDTH);
 
-// TODO: since we are not drawing in parallel, perhaps we can use a single buffer for all text renderings
-static char frequencyRepr[11] = {' ', '2', '8', '.', '1', '1', '0', '.', '2', '0', '\0'};
-static char ritRepr[6] = {'+', '9', '.', '9', '9', '\0'};
-static char wpmRepr[7] = {'2', '0', ' ', 'W', 'P', 'M', '\0'};
-static char bandRepr[5] = {'1', '6', '0', 'M', '\0'};
-static char pitchRepr[7] = {'1', '2', '0', '0', 'H', 'Z', '\0'};
-
-void XcvrUi::render() {
-    display->firstPage();
-    do {
-        draw();
-    } while (display->nextPage());
-
-    xcvr->clearStatusChange();
-    keyer->config_dirty = 0;
+    meter.drawnBar = meter.bar;
+    meter.drawnTuning = meter.tuning;
+    meter.drawnSignal = meter.signal;
+    meter.drawnValid = true;
 }
 
+#endif
+
 void XcvrUi::draw() {
     display->setFont(font_frequency);
 
     // render frequency
     renderFrequency();
-    display->drawStr(0, 12, frequencyRepr);
+    display->drawStr(0, 12, uiText);
+    display->drawHLine(stepDigitPosition() * FREQUENCY_GLYPHS_WIDTH, STEP_UNDERLINE_ROW, FREQUENCY_GLYPHS_WIDTH);
 
 
     display->setFont(font_ui);
-    if (xcvr->isRitOn()) {
+    if (shown.ritOn) {
         renderRit();
         if (mode == SETTING_RIT) {
             display->drawRBox(88, 0, 31, 10, 2);
             display->setColorIndex(0);
-            display->drawStr(90, 9, ritRepr);
+            display->drawStr(90, 9, uiText);
             display->setColorIndex(1);
         } else {
-            display->drawStr(90, 9, ritRepr);
+            display->drawStr(90, 9, uiText);
         }
     }
 
     // render wpm
-    wpmRepr[0] = (keyer->configuration.wpm > 9) ? (keyer->configuration.wpm / 10) + '0' : ' ';
-    wpmRepr[1] = (char)(keyer->configuration.wpm % 10) + '0';
+    renderWpm();
 
     if (mode == SETTING_SPEED) {
         display->drawRBox(0, 17, 53, 17, 2);
         display->setColorIndex(0);
-        display->drawStr(2, 30, wpmRepr);
+        display->drawStr(2, 30, uiText);
         display->setColorIndex(1);
     } else {
-        display->drawStr(2, 30, wpmRepr);
+        display->drawStr(2, 30, uiText);
     }
 
     // render keyer mode
@@ -189,24 +1284,24 @@ void XcvrUi::draw() {
         display->drawRBox(58, 17, 73, 17, 2);
         display->setColorIndex(0);
     }
-    switch (keyer->configuration.keyer_mode) {
+    switch (shown.keyerMode) {
         case STRAIGHT:
-            display->drawStr(60, 30, "STRAIGHT ");
+            display->drawStrP(60, 30, U8G_PSTR("STRAIGHT "));
             break;
         case IAMBIC_A:
-            display->drawStr(60, 30, "IAMBIC A ");
+            display->drawStrP(60, 30, U8G_PSTR("IAMBIC A "));
             break;
         case IAMBIC_B:
-            display->drawStr(60, 30, "IAMBIC B ");
+            display->drawStrP(60, 30, U8G_PSTR("IAMBIC B "));
             break;
         case BUG:
-            display->drawStr(60, 30, "   BUG   ");
+            display->drawStrP(60, 30, U8G_PSTR("   BUG   "));
             break;
         case ULTIMATIC:
-            display->drawStr(60, 30, "ULTIMATIC");
+            display->drawStrP(60, 30, U8G_PSTR("ULTIMATIC"));
             break;
         case TUNING:
-            display->drawStr(60, 30, " TUNING  ");
+            display->drawStrP(60, 30, U8G_PSTR(" TUNING  "));
             break;
         default:
             break;
@@ -217,127 +1312,628 @@ void XcvrUi::draw() {
 
 
     // render band
-    Band& band = xcvr->bands[xcvr->getBand()];
-    if (band.meters == 0) {
-        bandRepr[0] = 'E';
-        bandRepr[1] = 'X';
-        bandRepr[2] = 'T';
-        bandRepr[3] = '.';
-    } else {
-        bandRepr[0] = band.meters > 99 ? + '1' : ' ';
-        bandRepr[1] = ((band.meters / 10) % 10) + '0';
-        bandRepr[2] = (band.meters % 10) + '0';
-        bandRepr[3] = 'M';
-    }
+    renderBand();
     if (mode == SETTING_BAND) {
         display->drawRBox(0, 34, 36, 17, 2);
         display->setColorIndex(0);
-        display->drawStr(2, 47, bandRepr);
+        display->drawStr(2, 47, uiText);
         display->setColorIndex(1);
     } else {
-        display->drawStr(2, 47, bandRepr);
+        display->drawStr(2, 47, uiText);
     }
 
     // render cw pitch
-    pitchRepr[0] = xcvr->cwPitch > 999 ? (xcvr->cwPitch / 1000) + '0' : ' ';
-    pitchRepr[1] = ((xcvr->cwPitch / 100) % 10) + '0';
-    pitchRepr[2] = ((xcvr->cwPitch / 10) % 10) + '0';
-    pitchRepr[3] = (xcvr->cwPitch % 10) + '0';
+    renderPitch();
 
     if (mode == SETTING_CW_PITCH) {
         display->drawRBox(80, 34, 38, 17, 2);
         display->setColorIndex(0);
-        display->drawStr(82, 47, pitchRepr);
+        display->drawStr(82, 47, uiText);
         display->setColorIndex(1);
     } else {
-        display->drawStr(82, 47, pitchRepr);
+        display->drawStr(82, 47, uiText);
     }
 
-    // render features
-    display->drawStr(2, 64, "ATT");
-    display->drawStr(30, 64, "AMP");
-    display->drawStr(60, 64, "PTT");
+    // render features, or the memory channel or scan in their place
+    if (mode == SETTING_MEMORY || mode == SCANNING) {
+        display->drawRBox(0, 53, 56, 11, 2);
+        display->setColorIndex(0);
+        if (mode == SETTING_MEMORY) {
+            renderMemory();
+            display->drawStr(2, 63, uiText);
+        } else {
+            display->drawStrP(2, 63, shown.scanSource == SCAN_MEMORIES ? U8G_PSTR("MEM") : U8G_PSTR("BND"));
+            switch (shown.scanState) {
+                case SCAN_RUNNING:
+                    display->drawStrP(28, 63, shown.scanDirection > 0 ? U8G_PSTR("UP") : U8G_PSTR("DN"));
+                    break;
+                case SCAN_HOLDING:
+                    display->drawStrP(28, 63, U8G_PSTR("HLD"));
+                    break;
+                default:
+                    break;
+            }
+        }
+        display->setColorIndex(1);
+    } else {
+        display->drawStrP(2, 64, U8G_PSTR("ATT"));
+        display->drawStrP(30, 64, U8G_PSTR("AMP"));
+        display->drawStrP(60, 64, U8G_PSTR("PTT"));
+    }
 
     // render pitch
 
 }
 
 void XcvrUi::renderFrequency() {
-    long long& f = xcvr->frequency;
+    long f = shown.frequency;
 
-    frequencyRepr[2] = f >= 1000000 ? '.' : ' ';
+    uiText[3] = '.';
+    uiText[7] = '.';
+    uiText[10] = '\0';
 
     unsigned char unit = 0;
     bool hasHundreds = false;
 
-    unit = f / 100000000LL;
+    unit = f / 100000000L;
     if (unit > 0) {
-        frequencyRepr[0] = '0' + unit;
+        uiText[0] = '0' + unit;
         hasHundreds = true;
     } else {
-        frequencyRepr[0] = ' ';
+        uiText[0] = ' ';
     }
 
-    unit = (f / 10000000LL) % 10;
+    unit = (f / 10000000L) % 10;
     if (unit > 0 || hasHundreds) {
-        frequencyRepr[1] = '0' + unit;
+        uiText[1] = '0' + unit;
     } else {
-        frequencyRepr[1] = ' ';
+        uiText[1] = ' ';
     }
 
-    unit = (f / 1000000LL) % 10;
-    frequencyRepr[2] = '0' + unit;
+    unit = (f / 1000000L) % 10;
+    uiText[2] = '0' + unit;
+
+    unit = (f / 100000L) % 10;
+    uiText[4] = '0' + unit;
+
+    unit = (f / 10000L) % 10;
+    uiText[5] = '0' + unit;
+
+    unit = (f / 1000L) % 10;
+    uiText[6] = '0' + unit;
 
-    unit = (f / 100000LL) % 10;
-    frequencyRepr[4] = '0' + unit;
+    unit = (f / 100L) % 10;
+    uiText[8] = '0' + unit;
 
-    unit = (f / 10000LL) % 10;
-    frequencyRepr[5] = '0' + unit;
+    unit = (f / 10L) % 10;
+    uiText[9] = '0' + unit;
+}
+
+void XcvrUi::renderBand() {
+    byte meters = pgm_read_byte(&bandPlan[shown.band].meters);
+    uiText[0] = meters > 99 ? + '1' : ' ';
+    uiText[1] = ((meters / 10) % 10) + '0';
+    uiText[2] = (meters % 10) + '0';
+    uiText[3] = 'M';
+    uiText[4] = '\0';
+}
+
+// "M07 ABC", or "M--" before a channel was recalled or stored
+void XcvrUi::renderMemory() {
+    uiText[0] = 'M';
+    if (shown.memory >= MEMORY_CHANNELS) {
+        uiText[1] = '-';
+        uiText[2] = '-';
+        uiText[3] = '\0';
+        return;
+    }
+    uiText[1] = (shown.memory / 10) + '0';
+    uiText[2] = (shown.memory % 10) + '0';
+    uiText[3] = ' ';
+    memcpy(uiText + 4, memoryLabel, sizeof(memoryLabel));
+}
 
-    unit = (f / 1000LL) % 10;
-    frequencyRepr[6] = '0' + unit;
+// position of the digit the tuning step changes in the frequency text
+byte XcvrUi::stepDigitPosition() {
+    static const byte positions[] = {9, 8, 6, 5};
+    return positions[stepIndex];
+}
 
-    unit = (f / 100LL) % 10;
-    frequencyRepr[8] = '0' + unit;
+void XcvrUi::renderWpm() {
+    uiText[0] = (shown.wpm > 9) ? (shown.wpm / 10) + '0' : ' ';
+    uiText[1] = (char)(shown.wpm % 10) + '0';
+    strcpy_P(uiText + 2, PSTR(" WPM"));
+}
 
-    unit = (f / 10LL) % 10;
-    frequencyRepr[9] = '0' + unit;
+void XcvrUi::renderPitch() {
+    uiText[0] = shown.cwPitch > 999 ? (shown.cwPitch / 1000) + '0' : ' ';
+    uiText[1] = ((shown.cwPitch / 100) % 10) + '0';
+    uiText[2] = ((shown.cwPitch / 10) % 10) + '0';
+    uiText[3] = (shown.cwPitch % 10) + '0';
+    strcpy_P(uiText + 4, PSTR("HZ"));
 }
 
 void XcvrUi::renderRit() {
-    short r = xcvr->getRitAmount();
+    short r = shown.ritAmount;
     short absR = abs(r);
 
-    ritRepr[0] = r < 0 ? '-' : '+';
+    uiText[0] = r < 0 ? '-' : '+';
+    uiText[2] = '.';
+    uiText[5] = '\0';
 
     unsigned char unit = 0;
     unit = (absR / 1000) % 10;
-    ritRepr[1] = '0' + unit;
+    uiText[1] = '0' + unit;
     unit = (absR / 100) % 10;
-    ritRepr[3] = '0' + unit;
+    uiText[3] = '0' + unit;
     unit = (absR / 10) % 10;
-    ritRepr[4] = '0' + unit;
+    uiText[4] = '0' + unit;
+}
+
+
+void XcvrUi::handleInput(const InputEvent& event, unsigned long now) {
+    if (scan.state != SCAN_STOPPED) {
+        if (event.type == TRACE_ENCODER_DELTA && now - scan.lastTurn < SCAN_START_GUARD_MILLISECONDS) {
+            // the rest of the turn that started the scan
+            scan.lastTurn = now;
+            currentEncoderValue = 0;
+            return;
+        }
+        // whatever the input, it stops the scan first; the turn that did it is not a turn
+        stopScan();
+        if (event.type == TRACE_ENCODER_DELTA) {
+            currentEncoderValue = 0;
+            return;
+        }
+    }
+
+    switch (event.type) {
+        case TRACE_MODE_BUTTON:
+            if (event.value == LOW) {
+                modeButton.press(now);
+            } else {
+                modeButton.release(now);
+            }
+            break;
+        case TRACE_ENCODER_BUTTON:
+            if (event.value == LOW) {
+                encoderButton.press(now);
+            } else {
+                encoderButton.release(now);
+            }
+            break;
+        case TRACE_ENCODER_DELTA: {
+            currentEncoderValue += event.value;
+            int amountToAdd = (currentEncoderValue / 3);
+            if (amountToAdd != 0) {
+                currentEncoderValue -= amountToAdd * 3;
+
+                // turning while a button is held is a gesture of its own
+                if (!encoderButton.turn(amountToAdd) && !modeButton.turn(amountToAdd)) {
+                    handleTurn(amountToAdd);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void XcvrUi::handleTurn(int amount) {
+    switch (mode) {
+        case NORMAL:
+            xcvr->incrementFrequency((long) amount * stepSize);
+            break;
+        case SETTING_RIT:
+            xcvr->ritIncrement(amount * 10);
+            break;
+        case SETTING_SPEED:
+            keyer->speed_change(amount);
+            break;
+        case SETTING_KEYER_MODE:
+            keyer->next_keyer_mode();
+            break;
+        case SETTING_CW_PITCH:
+            keyer->sidetone_adj(amount * 10);
+            xcvr->setCwPitch(keyer->configuration.hz_sidetone);
+            break;
+        case SETTING_BAND:
+            if (amount > 0)
+                xcvr->nextBand();
+            else
+                xcvr->previousBand();
+            break;
+        case SETTING_MEMORY: {
+            byte channel = MemoryStore::next(memory, amount > 0 ? 1 : -1);
+            if (channel != NO_MEMORY) {
+                recallMemory(channel);
+            }
+            break;
+        }
+        case SCANNING:
+            startScan(amount > 0 ? 1 : -1);
+            break;
+        default:
+            break;
+    }
+}
+
+void XcvrUi::handleModeButton(byte gesture, short turned) {
+    switch (gesture) {
+        case GESTURE_CLICK:
+            setMode(mode + 1);
+            break;
+        case GESTURE_DOUBLE_CLICK:
+            setMode(mode == NORMAL ? LAST_MODE - 1 : mode - 1);
+            break;
+        case GESTURE_HOLD:
+            setMode(NORMAL);
+            break;
+        case GESTURE_HOLD_TURN:
+            keyer->speed_change(turned);
+            break;
+        default:
+            break;
+    }
+}
+
+void XcvrUi::handleEncoderButton(byte gesture, short turned) {
+    switch (gesture) {
+        case GESTURE_CLICK:
+            if (mode == SCANNING) {
+                scan.source = scan.source == SCAN_BAND ? SCAN_MEMORIES : SCAN_BAND;
+                publishState();
+            } else {
+                xcvr->nextBand();
+            }
+            break;
+        case GESTURE_DOUBLE_CLICK:
+            xcvr->ritReset();
+            break;
+        case GESTURE_HOLD:
+            xcvr->setRit(!xcvr->isRitOn());
+            break;
+        case GESTURE_LONG_HOLD:
+            storeMemory(MemoryStore::firstFree(), "");
+            break;
+        case GESTURE_HOLD_TURN:
+            changeStepSize(turned);
+            break;
+        default:
+            break;
+    }
+}
+
+static const long stepSizes[] = {10, 100, 1000, 10000};
+#define NUMBER_OF_STEP_SIZES (sizeof(stepSizes) / sizeof(stepSizes[0]))
+
+void XcvrUi::changeStepSize(short amount) {
+    char index = stepIndex + amount;
+    if (index < 0) {
+        index = 0;
+    } else if (index >= (char) NUMBER_OF_STEP_SIZES) {
+        index = NUMBER_OF_STEP_SIZES - 1;
+    }
+    stepIndex = index;
+    stepSize = stepSizes[stepIndex];
+    publishState();
+}
+
+void XcvrUi::setMode(byte newMode) {
+    if (newMode == SETTING_RIT && !xcvr->isRitOn()) {
+        newMode = newMode > mode ? newMode + 1 : newMode - 1;
+    }
+    mode = newMode % LAST_MODE;
+    if (mode != SCANNING) {
+        scan.state = SCAN_STOPPED;
+    }
+
+    switch (mode) {
+        case SETTING_SPEED:
+            keyer->key_tx = 0;
+            break;
+        default:
+            keyer->key_tx = 1;
+            break;
+    }
+
+    publishState();
+}
+
+void XcvrUi::publishState() {
+    RadioState& state = radioState.edit();
+    state.uiMode = mode;
+    state.stepIndex = stepIndex;
+    state.scanState = scan.state;
+    state.scanDirection = scan.direction;
+    state.scanSource = scan.source;
+    state.memory = memory;
+    radioState.publish(STATE_BIT(STATE_UI));
 }
 
+void XcvrUi::recallMemory(byte channel) {
+    MemoryChannel stored;
+    if (!MemoryStore::read(channel, stored)) {
+        return;
+    }
+    xcvr->recall(stored);
+    memory = channel;
+    memcpy(memoryLabel, stored.label, sizeof(memoryLabel));
+    publishState();
+}
+
+void XcvrUi::storeMemory(byte channel, const char* label) {
+    if (channel >= MEMORY_CHANNELS) {
+        return;
+    }
+    MemoryChannel current;
+    xcvr->store(current);
+    // labels are padded with spaces, so that the display always has three characters
+    byte length = strlen(label);
+    for (byte i = 0; i < MEMORY_LABEL_LENGTH; i++) {
+        current.label[i] = i < length ? label[i] : ' ';
+    }
+    current.label[MEMORY_LABEL_LENGTH] = '\0';
+    MemoryStore::write(channel, current);
+    memory = channel;
+    memcpy(memoryLabel, current.label, sizeof(memoryLabel));
+    publishState();
+}
+
+// "QSK" reports the sequencer's times, "QSK <lead> [<tail>]" sets the lead, and the tail when
+// given, first. Times outside 0..255 ms are ignored.
+void XcvrUi::handleQskCommand(const char* arguments) {
+    char* end;
+    long lead = strtol(arguments, &end, 10);
+    if (end != arguments) {
+        if (lead >= 0 && lead <= 255) {
+            keyer->ptt_lead_time = lead;
+        }
+        const char* rest = end;
+        long tail = strtol(rest, &end, 10);
+        if (end != rest && tail >= 0 && tail <= 255) {
+            keyer->ptt_tail_time = tail;
+        }
+    }
+
+    char buffer[12];
+    Serial.print(F("QSK L"));
+    Serial.write(itoa(keyer->ptt_lead_time, buffer, 10));
+    Serial.print(F(" T"));
+    Serial.write(itoa(keyer->ptt_tail_time, buffer, 10));
+    Serial.print(F(" KEYRF"));
+    Serial.write(ultoa(keyer->key_to_rf_micros, buffer, 10));
+    Serial.print(F(" RFRX"));
+    Serial.write(ultoa(keyer->rf_to_receive_micros, buffer, 10));
+    Serial.print(F("\n"));
+}
+
+void XcvrUi::listMemories() {
+    char buffer[12];
+    MemoryChannel stored;
+    for (byte channel = 0; channel < MEMORY_CHANNELS; channel++) {
+        if (!MemoryStore::read(channel, stored)) {
+            continue;
+        }
+        Serial.print(F("MEM "));
+        Serial.write(itoa(channel, buffer, 10));
+        Serial.print(F(" F"));
+        Serial.write(ultoa(stored.frequency, buffer, 10));
+        Serial.print(F(" R"));
+        Serial.write(itoa(stored.ritAmount, buffer, 10));
+        Serial.print(stored.ritOn ? F(" ON") : F(" OFF"));
+        Serial.print(F(" S"));
+        Serial.write(itoa(stored.sideband, buffer, 10));
+        Serial.print(F(" L"));
+        Serial.write(stored.label);
+        Serial.print(F("\n"));
+    }
+    Serial.print(F("MEM END\n"));
+}
+
+void XcvrUi::startScan(char direction) {
+    scan.state = SCAN_RUNNING;
+    scan.direction = direction;
+    scan.stepTime = millis();
+    scan.lastTurn = scan.stepTime;
+    publishState();
+}
+
+void XcvrUi::stopScan() {
+    scan.state = SCAN_STOPPED;
+    publishState();
+}
+
+// Takes the next scan step once the dwell time is over. Steps go through incrementFrequency(),
+// which only rewrites the VFO, and are left for the keyer's idle windows like the display is.
+void XcvrUi::serviceScan(unsigned long now) {
+    if (scan.state == SCAN_STOPPED) {
+        return;
+    }
+    if (!keyer->idle_window()) {
+        // a paddle is down or the keyer is sending
+        stopScan();
+        return;
+    }
+
+#if XCVR_AUDIO_METER
+    // the first block after a step may still hold audio from the last frequency
+    if (meter.blocks >= 2 && meter.blockSignal) {
+        if (scan.state != SCAN_HOLDING) {
+            scan.state = SCAN_HOLDING;
+            publishState();
+        }
+        scan.stepTime = now; // dwell on from the last time it was heard
+        return;
+    }
+#endif
+    if (now - scan.stepTime < SCAN_DWELL_MILLISECONDS) {
+        return;
+    }
+    if (scan.state == SCAN_HOLDING) {
+        scan.state = SCAN_RUNNING;
+        publishState();
+    }
+
+    if (scan.source == SCAN_MEMORIES) {
+        byte channel = MemoryStore::next(memory, scan.direction);
+        if (channel == NO_MEMORY) {
+            stopScan(); // nothing stored
+            return;
+        }
+        recallMemory(channel);
+    } else {
+        xcvr->incrementFrequency(nextScanFrequency() - (long) xcvr->frequency);
+    }
+    scan.stepTime = now;
+#if XCVR_AUDIO_METER
+    meter.blocks = 0;
+#endif
+}
+
+// One step on from the current frequency, wrapping around at the edges of the band.
+long XcvrUi::nextScanFrequency() {
+    Band band;
+    Xcvr::getBandPlan(xcvr->getBand(), band);
+    long low = band.startFrequency * 1000L;
+    long high = band.endFrequency * 1000L;
+
+    long next = (long) xcvr->frequency + scan.direction * stepSize;
+    if (next > high) {
+        next = low;
+    } else if (next < low) {
+        next = high;
+    }
+    return next;
+}
 
 void XcvrUi::advertiseStatus() {
+    RadioState state;
+    radioState.read(state);
+
     char buffer[12];
-    Serial.write("STS F");
-    Serial.write(ltoa(xcvr->frequency, buffer, 10));
-    Serial.write(" R");
-    Serial.write(itoa(xcvr->ritAmount, buffer, 10));
-    Serial.write(" S");
-    Serial.write(itoa(xcvr->sideband, buffer, 10));
-    Serial.write(" B");
-    Serial.write(itoa(xcvr->bandIndex, buffer, 10));
-    Serial.write(" P");
-    Serial.write(itoa(xcvr->cwPitch, buffer, 10));
-    Serial.write(" W");
-    Serial.write(itoa(keyer->configuration.wpm, buffer, 10));
-    Serial.write("\n");
+    Serial.print(F("STS F"));
+    Serial.write(ltoa(state.frequency, buffer, 10));
+    Serial.print(F(" R"));
+    Serial.write(itoa(state.ritAmount, buffer, 10));
+    Serial.print(F(" S"));
+    Serial.write(itoa(state.sideband, buffer, 10));
+    Serial.print(F(" B"));
+    Serial.write(itoa(state.band, buffer, 10));
+    Serial.print(F(" P"));
+    Serial.write(itoa(state.cwPitch, buffer, 10));
+    Serial.print(F(" W"));
+    Serial.write(itoa(state.wpm, buffer, 10));
+    Serial.print(F(" E"));
+    Serial.write(itoa(state.effectiveWpm, buffer, 10));
+    Serial.print(F("\n"));
     lastStatusAdvertiseTime = millis();
 }
 
+void XcvrUi::serviceSerial() {
+#if XCVR_TRACE == TRACE_REPLAY
+    // the serial input carries the trace being replayed
+    Trace::service();
+    return;
+#endif
+    while (Serial.available() > 0) {
+        char c = Serial.read();
+        if (c == '\r') {
+            continue;
+        }
+        if (c == '\n') {
+            commandBuffer[commandLength] = '\0';
+            handleCommand(commandBuffer);
+            commandLength = 0;
+        } else if (commandLength < sizeof(commandBuffer) - 1) {
+            commandBuffer[commandLength++] = c;
+        }
+    }
+}
+
+// A channel number from a serial command, NO_MEMORY when it is missing or out of range
+static byte memoryChannelArgument(const char* argument) {
+    char* end;
+    long channel = strtol(argument, &end, 10);
+    return (end == argument || channel < 0 || channel >= MEMORY_CHANNELS) ? NO_MEMORY : channel;
+}
+
+void XcvrUi::handleCommand(const char* command) {
+    if (strcmp(command, "EVQ") == 0) {
+        InputQueue::dump();
+    } else if (strcmp(command, "EVR") == 0) {
+        InputQueue::reset();
+    }
+#if XCVR_FRAME_MONITOR
+    if (strcmp(command, "FRS") == 0) {
+        FrameMonitor::dump();
+    } else if (strcmp(command, "FRM") == 0) {
+        dumpFrame();
+    }
+#endif
+#if XCVR_BUS_ACCOUNTING
+    if (strcmp(command, "BUS") == 0) {
+        BusMonitor::dump();
+    } else if (strcmp(command, "BUR") == 0) {
+        BusMonitor::reset();
+    }
+#endif
+#if XCVR_STATS
+    if (strcmp(command, "STA") == 0) {
+        OperatingStats::dump();
+    } else if (strcmp(command, "STC") == 0) {
+        OperatingStats::clear();
+    }
+#endif
+    if (strncmp(command, "FWS", 3) == 0) {
+        // "FWS <wpm>" sends the characters at the keyer speed and spaces them for <wpm>, "FWS" or
+        // "FWS 0" stops; speeds from wpm_limit_low up to the keyer speed are taken
+        char* end;
+        long wpm = strtol(command + 3, &end, 10);
+        if (end == command + 3 || wpm == 0) {
+            keyer->farnsworth_set(0);
+        } else if (wpm >= wpm_limit_low && wpm <= keyer->configuration.wpm) {
+            keyer->farnsworth_set(wpm);
+        }
+    }
+    if (strncmp(command, "QSK", 3) == 0) {
+        handleQskCommand(command + 3);
+    }
+    if (strcmp(command, "ML") == 0) {
+        listMemories();
+    } else if (strncmp(command, "MR", 2) == 0) {
+        recallMemory(memoryChannelArgument(command + 2));
+    } else if (strncmp(command, "MW", 2) == 0) {
+        // "MW" alone takes the first free channel, "MW nn" and "MW nn LBL" that one
+        if (command[2] == '\0') {
+            storeMemory(MemoryStore::firstFree(), "");
+        } else {
+            const char* label = strchr(command + 3, ' ');
+            storeMemory(memoryChannelArgument(command + 2), label != NULL ? label + 1 : "");
+        }
+    } else if (strncmp(command, "ME", 2) == 0) {
+        MemoryStore::erase(memoryChannelArgument(command + 2));
+    }
+#if XCVR_RAM_REPORT
+    if (strcmp(command, "RAM") == 0) {
+        reportRam();
+    }
+#endif
+#if XCVR_KEYER_BENCHMARK
+    if (strncmp(command, "KBM", 3) == 0) {
+        KeyerBenchmark::run(*keyer, atoi(command + 3));
+    }
+#endif
+#if XCVR_PROFILING
+    if (strcmp(command, "PRF") == 0) {
+        Profiler::dump();
+    } else if (strcmp(command, "PRR") == 0) {
+        Profiler::reset();
+    }
+#endif
+}
+
 // --------------------------------------------
 
 void Xcvr::init(void) {
@@ -351,34 +1947,14 @@ void Xcvr::init(void) {
 
     si5351.set_pll(SI5351_PLL_FIXED, SI5351_PLLA);
 
-    // set band settings
-    bands[0].startFrequency = 1800;
-    bands[1].startFrequency = 3500;
-    bands[2].startFrequency = 7000;
-    bands[3].startFrequency = 10000;
-    bands[4].startFrequency = 14000;
-    bands[5].startFrequency = 18000;
-    bands[6].startFrequency = 21000;
-    bands[7].startFrequency = 24000;
-    bands[8].startFrequency = 28000;
-    bands[9].startFrequency = 10000;
-
-    bands[0].meters = 160;
-    bands[1].meters = 80;
-    bands[2].meters = 40;
-    bands[3].meters = 30;
-    bands[4].meters = 20;
-    bands[5].meters = 17;
-    bands[6].meters = 15;
-    bands[7].meters = 12;
-    bands[8].meters = 10;
-
-    filters[0].centerFrequency = 9000000LL;
+    filters[0].centerFrequency = 9000000UL;
     filters[0].bandwidth = 500;
 
     mcp.begin();
-    for (byte i = 0; i < 10; i++) {
-        mcp.pinMode(i, OUTPUT);
+    for (byte i = 0; i < 16; i++) {
+        if (EXPANDER_OUTPUT_PINS & (1 << i)) {
+            mcp.pinMode(i, OUTPUT);
+        }
     }
 
     setRit(true);
@@ -396,50 +1972,150 @@ void Xcvr::setFilter(unsigned char index) {
 }
 
 void Xcvr::setSideband(Sideband sideband) {
+    BUS_OPERATION(BUS_SIDEBAND);
     this->sideband = sideband;
     recalculateBfo();
     setBfoFrequency();
+    publishState(STATE_BIT(STATE_SIDEBAND));
 }
 
 // -----------------------------------------------------------------------------
 
-#define NUMBER_OF_BANDS 10
+#if XCVR_IARU_REGION == 1
+#define BAND_160M_EDGES 1810, 2000
+#define BAND_80M_EDGES 3500, 3800
+#define BAND_40M_EDGES 7000, 7200
+#elif XCVR_IARU_REGION == 2
+#define BAND_160M_EDGES 1800, 2000
+#define BAND_80M_EDGES 3500, 4000
+#define BAND_40M_EDGES 7000, 7300
+#elif XCVR_IARU_REGION == 3
+#define BAND_160M_EDGES 1800, 2000
+#define BAND_80M_EDGES 3500, 3900
+#define BAND_40M_EDGES 7000, 7200
+#else
+#error "XCVR_IARU_REGION must be 1, 2 or 3"
+#endif
+
+// edges in KHz, meters, default sideband, filter, band filter pins on the port expander
+const Band bandPlan[BAND_COUNT] PROGMEM = {
+    {BAND_160M_EDGES, 160, LSB, 0, 1 << 0},
+    {BAND_80M_EDGES, 80, LSB, 0, 1 << 1},
+    {BAND_40M_EDGES, 40, LSB, 0, 1 << 2},
+    {10100, 10150, 30, USB, 0, 1 << 3},
+    {14000, 14350, 20, USB, 0, 1 << 4},
+    {18068, 18168, 17, USB, 0, 1 << 5},
+    {21000, 21450, 15, USB, 0, 1 << 6},
+    {24890, 24990, 12, USB, 0, 1 << 7},
+    {28000, 29700, 10, USB, 0, 1 << 8},
+};
+
+void Xcvr::getBandPlan(byte index, Band& band) {
+    memcpy_P(&band, &bandPlan[index], sizeof(Band));
+}
 
 void Xcvr::nextBand() {
     bandIndex++;
-    bandIndex %= NUMBER_OF_BANDS;
+    bandIndex %= BAND_COUNT;
+    STATS_COUNT(STAT_BAND_CHANGES);
     applyCurrentBandSettings();
 }
 
 void Xcvr::previousBand() {
     if (bandIndex == 0) {
-        bandIndex = NUMBER_OF_BANDS - 1;
+        bandIndex = BAND_COUNT - 1;
     } else {
         bandIndex--;
     }
+    STATS_COUNT(STAT_BAND_CHANGES);
     applyCurrentBandSettings();
 }
 
 void Xcvr::applyCurrentBandSettings() {
-    frequency = bands[bandIndex].startFrequency * 1000LL; // from KHz to Hz
-    transmitVfoFrequency = abs(frequency - filters[filterIndex].centerFrequency) * 100;
-    setSideband(bands[bandIndex].isUpperSideband ? USB : LSB);
+    BUS_OPERATION(BUS_BAND);
+    frequency = pgm_read_word(&bandPlan[bandIndex].startFrequency) * 1000UL; // from KHz to Hz
+    applyBand();
     // ritReset();
-    receiveVfoFrequency = transmitVfoFrequency + (isRitOn() ? ritAmount : 0) * 100;;
-    setVfoFrequency();
+    updateVfoFrequencies();
+    publishState(STATE_BIT(STATE_FREQUENCY) | STATE_BIT(STATE_BAND));
+}
+
+// filter, sideband and band filters of bandIndex, leaves the VFO alone
+void Xcvr::applyBand() {
+    Band band;
+    getBandPlan(bandIndex, band);
+    filterIndex = band.filterIndex;
+    bandHoldLow = band.startFrequency * 1000UL - BAND_TRACKING_HYSTERESIS;
+    bandHoldHigh = band.endFrequency * 1000UL + BAND_TRACKING_HYSTERESIS;
+    setSideband((Sideband) band.sideband);
     switchBandFilters();
 }
 
-void Xcvr::switchBandFilters() {
-    for (byte i = 0; i < 10; i++) {
-        mcp.digitalWrite(i, i == bandIndex ? HIGH : LOW);
+// the band whose edges hold frequency, or NO_BAND when it is in between bands
+byte Xcvr::findBand(freq_t frequency) {
+    int low = 0;
+    int high = BAND_COUNT - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        if (frequency < (freq_t) pgm_read_word(&bandPlan[middle].startFrequency) * 1000) {
+            high = middle - 1;
+        } else if (frequency > (freq_t) pgm_read_word(&bandPlan[middle].endFrequency) * 1000) {
+            low = middle + 1;
+        } else {
+            return middle;
+        }
+    }
+    return NO_BAND;
+}
+
+// Follows the tuned frequency into another band. The current band is kept until the frequency is
+// more than BAND_TRACKING_HYSTERESIS outside of it and inside another one, so that tuning back and
+// forth over an edge does not flip the relays, and in between bands nothing changes at all.
+bool Xcvr::trackBand() {
+    if (frequency >= bandHoldLow && frequency <= bandHoldHigh) {
+        return false;
+    }
+    byte band = findBand(frequency);
+    if (band == NO_BAND || band == bandIndex) {
+        return false;
     }
+    bandIndex = band;
+    STATS_COUNT(STAT_BAND_CHANGES);
+    applyBand();
+    return true;
+}
+
+freq_t Xcvr::vfoFrequencyFor(freq_t frequency) {
+    return mixVfoFrequency(frequency, filters[filterIndex].centerFrequency);
+}
+
+void Xcvr::updateVfoFrequencies() {
+    transmitVfoFrequency = vfoFrequencyFor(frequency);
+    receiveVfoFrequency = vfoFrequencyFor(ritFrequency(frequency, isRitOn(), ritAmount));
+    setVfoFrequency();
+}
+
+void Xcvr::switchBandFilters() {
+    PROFILE_SCOPE(PROBE_EXPANDER_WRITE);
+    STATS_COUNT(STAT_EXPANDER_WRITES);
+    // a single write for both ports instead of a read-modify-write per pin
+    unsigned short pins = pgm_read_word(&bandPlan[bandIndex].expanderMask);
+#if XCVR_BUS_ACCOUNTING
+    unsigned long start = micros();
+    mcp.writeGPIOAB(pins);
+    BusMonitor::expanderWrite(pins, micros() - start);
+#else
+    mcp.writeGPIOAB(pins);
+#endif
 }
 
 // -----------------------------------------------------------------------------
 
 void Xcvr::ritReset() {
+    BUS_OPERATION(BUS_RIT);
     ritAmount = 0;
+    updateVfoFrequencies();
+    publishState(STATE_BIT(STATE_RIT));
 }
 
 bool Xcvr::isRitOn() {
@@ -447,92 +2123,137 @@ bool Xcvr::isRitOn() {
 }
 
 void Xcvr::setRit(bool on) {
+    BUS_OPERATION(BUS_RIT);
     if (on)
         this->flags |= RIT_ON;
     else
         this->flags &= ~RIT_ON;
 
-    receiveVfoFrequency = transmitVfoFrequency + (isRitOn() ? ritAmount : 0) * 100;;
-    setVfoFrequency();
+    updateVfoFrequencies();
+    publishState(STATE_BIT(STATE_RIT));
 }
 
 void Xcvr::ritIncrement(short amount) {
+    BUS_OPERATION(BUS_RIT);
     this->ritAmount += amount;
-    receiveVfoFrequency = transmitVfoFrequency + (isRitOn() ? ritAmount : 0) * 100;;
-    setVfoFrequency();
+    updateVfoFrequencies();
+    publishState(STATE_BIT(STATE_RIT));
 }
 
 short Xcvr::getRitAmount() {
     return this->ritAmount;
 }
 
+// -----------------------------------------------------------------------------
+
+// Tunes to a memory channel: the band filters only change when it is in another band, the
+// rest goes through the same BFO and VFO writes as tuning does.
+void Xcvr::recall(const MemoryChannel& memory) {
+    BUS_OPERATION(BUS_RECALL);
+    frequency = memory.frequency;
+    byte band = findBand(frequency);
+    bool bandChanged = band != NO_BAND && band != bandIndex;
+    if (bandChanged) {
+        bandIndex = band;
+        STATS_COUNT(STAT_BAND_CHANGES);
+        applyBand();
+    }
+    filterIndex = memory.filterIndex < sizeof(filters) / sizeof(filters[0]) ? memory.filterIndex : 0;
+    ritAmount = memory.ritAmount;
+    if (memory.ritOn)
+        this->flags |= RIT_ON;
+    else
+        this->flags &= ~RIT_ON;
+
+    setSideband((Sideband) memory.sideband);
+    updateVfoFrequencies();
+    publishState(STATE_BIT(STATE_FREQUENCY) | STATE_BIT(STATE_RIT) | (bandChanged ? STATE_BIT(STATE_BAND) : 0));
+}
+
+void Xcvr::store(MemoryChannel& memory) {
+    memory.frequency = frequency;
+    memory.ritAmount = ritAmount;
+    memory.ritOn = isRitOn();
+    memory.sideband = sideband;
+    memory.filterIndex = filterIndex;
+}
+
 
 void Xcvr::setCwPitch(unsigned short int pitch) {
+    BUS_OPERATION(BUS_PITCH);
     cwPitch = pitch;
     recalculateBfo();
     setBfoFrequency();
-    statusChanged = true;
+    publishState(STATE_BIT(STATE_CW_PITCH));
 }
 
 // -----------------------------------------------------------------------------
 
 void Xcvr::key() {
+    BUS_OPERATION(BUS_KEY);
     inTransmitMode = true;
     // set VFOs to transmit mode
-    si5351.set_freq(transmitVfoFrequency, 0ULL, SI5351_CLK0);
-    si5351.set_freq(transmitBfoFrequency, 0ULL, SI5351_CLK2);
+    writeSynth(transmitVfoFrequency, SI5351_CLK0);
+    writeSynth(transmitBfoFrequency, SI5351_CLK2);
 }
 
 
 void Xcvr::unkey() {
+    BUS_OPERATION(BUS_UNKEY);
     inTransmitMode = false;
     // set VFOs to receive mode
-    si5351.set_freq(receiveVfoFrequency, 0ULL, SI5351_CLK0);
-    si5351.set_freq(receiveBfoFrequency, 0ULL, SI5351_CLK2);
+    writeSynth(receiveVfoFrequency, SI5351_CLK0);
+    writeSynth(receiveBfoFrequency, SI5351_CLK2);
 }
 
 
 // -----------------------------------------------------------------------------
 
 void Xcvr::recalculateBfo() {
-    if (sideband == USB)
-        receiveBfoFrequency = filters[filterIndex].centerFrequency + cwPitch;
-    else
-        receiveBfoFrequency = filters[filterIndex].centerFrequency - cwPitch;
-
-    // correct BFO if needed so that we don't get both sidebands of the signal
-    if (filters[filterIndex].bandwidth / 2 > cwPitch) {
-        short int amountToCorrect = filters[filterIndex].bandwidth / 2 - cwPitch;
-        if (sideband == USB)
-            receiveBfoFrequency += amountToCorrect;
-        else
-            receiveBfoFrequency -= amountToCorrect;
-    }
-
-    transmitBfoFrequency = sideband == USB ?
-                                receiveBfoFrequency - cwPitch :
-                                receiveBfoFrequency + cwPitch;
-
-    receiveBfoFrequency *= 100; // to hundreds of Hz
-    transmitBfoFrequency *= 100; // to hundreds of Hz
+    bfoFrequencies(filters[filterIndex].centerFrequency, filters[filterIndex].bandwidth, cwPitch, sideband == USB,
+                   receiveBfoFrequency, transmitBfoFrequency);
 }
 
-void Xcvr::incrementFrequency(int amount) {
-    short int hundredsOfHzAmount = amount * 100;
-    receiveVfoFrequency += hundredsOfHzAmount;
-    transmitVfoFrequency += hundredsOfHzAmount;
+void Xcvr::incrementFrequency(long amount) {
+    BUS_OPERATION(BUS_TUNE);
+    STATS_COUNT(STAT_TUNING_STEPS);
     frequency += amount;
-    setVfoFrequency();
+    bool bandChanged = trackBand();
+    updateVfoFrequencies();
+    publishState(STATE_BIT(STATE_FREQUENCY) | (bandChanged ? STATE_BIT(STATE_BAND) : 0));
+}
+
+// The only place where frequencies leave Hz: the Si5351 library counts in hundredths of Hz.
+void Xcvr::writeSynth(freq_t frequency, enum si5351_clock clock) {
+    PROFILE_SCOPE(PROBE_SYNTH_WRITE);
+    STATS_COUNT(STAT_SYNTH_WRITES);
+#if XCVR_BUS_ACCOUNTING
+    unsigned long start = micros();
+    si5351.set_freq(synthFrequency(frequency), 0ULL, clock);
+    BusMonitor::synthWrite(clock, frequency, micros() - start);
+#else
+    si5351.set_freq(synthFrequency(frequency), 0ULL, clock);
+#endif
+    TRACE_OUTPUT_PAYLOAD(TRACE_SYNTH, clock, frequency);
 }
 
 void Xcvr::setVfoFrequency() {
-    si5351.set_freq(receiveVfoFrequency, 0ULL, SI5351_CLK0);
-    statusChanged = true;
+    writeSynth(receiveVfoFrequency, SI5351_CLK0);
 }
 
 void Xcvr::setBfoFrequency() {
-    si5351.set_freq(receiveBfoFrequency, 0ULL, SI5351_CLK2);
-    statusChanged = true;
+    writeSynth(receiveBfoFrequency, SI5351_CLK2);
+}
+
+void Xcvr::publishState(unsigned short fields) {
+    RadioState& state = radioState.edit();
+    state.frequency = frequency;
+    state.ritAmount = ritAmount;
+    state.ritOn = isRitOn();
+    state.sideband = sideband;
+    state.band = bandIndex;
+    state.cwPitch = cwPitch;
+    radioState.publish(fields);
 }
 
 
@@ -551,6 +2272,8 @@ void Keyer::initialize_keyer_state() {
   //configuration.current_tx = 1;
   configuration.length_wordspace = default_length_wordspace;
   configuration.weighting = default_weighting;
+  configuration.farnsworth_wpm = 0;
+  compute_timing();
 }  
 
 
@@ -559,6 +2282,9 @@ void Keyer::initialize_keyer_state() {
 void Keyer::initialize_default_modes() {
   // setup default modes
   configuration.keyer_mode = IAMBIC_B;
+  if (!KEYER_MODE_ENABLED(configuration.keyer_mode)) {
+    next_keyer_mode();
+  }
   configuration.sidetone_mode = SIDETONE_ON;
 }  
 
@@ -588,134 +2314,135 @@ void Keyer::initialize_pins() {
     }
 }
 
-
-// Subroutines --------------------------------------------------------------------------------------------
-
-void Keyer::check_paddles() {
-  
-  #define NO_CLOSURE 0
-  #define DIT_CLOSURE_DAH_OFF 1
-  #define DAH_CLOSURE_DIT_OFF 2
-  #define DIT_CLOSURE_DAH_ON 3
-  #define DAH_CLOSURE_DIT_ON 4
-
-  static byte last_closure = NO_CLOSURE;
-
-  check_dit_paddle();
-  check_dah_paddle();
-
-  if (configuration.keyer_mode == ULTIMATIC) {
-    if (ultimatic_mode == ULTIMATIC_NORMAL) {
-      switch (last_closure) {
-        case DIT_CLOSURE_DAH_OFF:
-          if (dah_buffer) {
-            if (dit_buffer) {
-              last_closure = DAH_CLOSURE_DIT_ON;
-              dit_buffer = 0;
-            } else {
-              last_closure = DAH_CLOSURE_DIT_OFF;
+
+// Subroutines --------------------------------------------------------------------------------------------
+
+// Paddle state machine, see xcvr_paddles.h -----------------------------------------------------------------
+
+static const byte ultimatic_transitions[ULTIMATIC_MODES][CLOSURE_STATES * 4] PROGMEM = {
+  ULTIMATIC_TABLE(ULTIMATIC_NORMAL),
+  ULTIMATIC_TABLE(ULTIMATIC_DIT_PRIORITY),
+  ULTIMATIC_TABLE(ULTIMATIC_DAH_PRIORITY)
+};
+
+void Keyer::check_paddles() {
+  check_dit_paddle();
+  check_dah_paddle();
+
+  if (is_keyer_mode(ULTIMATIC)) {
+    byte transition = pgm_read_byte(&ultimatic_transitions[ultimatic_mode][CLOSURE_INDEX(paddle_closure, dit_buffer != 0, dah_buffer != 0)]);
+    paddle_closure = transition & CLOSURE_STATE_MASK;
+    if (transition & CLOSURE_CLEAR_DIT) {
+      dit_buffer = 0;
+    }
+    if (transition & CLOSURE_CLEAR_DAH) {
+      dah_buffer = 0;
+    }
+  }
+}
+//-------------------------------------------------------------------------------------------------------
+
+// the transitions, in the order their actions are done
+static const byte qskToTransmit[] PROGMEM = {
+    QSK_PTT_ON, QSK_SYNTH_TRANSMIT,
+    QSK_KEY_ON | QSK_AFTER_LEAD, QSK_FIRST_EXTENSION | QSK_AFTER_LEAD, QSK_SIDETONE_ON | QSK_AFTER_LEAD
+};
+static const byte qskKeyDown[] PROGMEM = {QSK_KEY_ON, QSK_SIDETONE_ON};
+static const byte qskKeyUp[] PROGMEM = {QSK_KEY_OFF, QSK_SIDETONE_OFF};
+static const byte qskToReceive[] PROGMEM = {QSK_SYNTH_RECEIVE, QSK_PTT_OFF};
+static const byte qskSidetoneOn[] PROGMEM = {QSK_SIDETONE_ON};
+static const byte qskSidetoneOff[] PROGMEM = {QSK_SIDETONE_OFF};
+
+#define QSK_RUN(actions) qsk_run(actions, sizeof(actions))
+
+void Keyer::qsk_run(const byte* actions, byte count) {
+    qsk_started = micros();
+    unsigned long lead = ptt_lead_time * 1000UL;
+    for (byte i = 0; i < count; i++) {
+        byte action = pgm_read_byte(&actions[i]);
+        if (action & QSK_AFTER_LEAD) {
+            // whatever the synth writes left of the lead time
+            while ((micros() - qsk_started) < lead) {
+            }
+        }
+        qsk_action(action & ~QSK_AFTER_LEAD);
+    }
+}
+
+void Keyer::qsk_action(byte action) {
+    switch (action) {
+        case QSK_PTT_ON:
+            if (KEYER_OUTPUTS_LIVE) {
+                digitalWrite(ptt_tx_1, HIGH);
             }
-          } else {
-            if (!dit_buffer) {
-              last_closure = NO_CLOSURE;
+            TRACE_OUTPUT(TRACE_PTT, HIGH);
+            ptt_line_activated = 1;
+            KEYER_BENCHMARK_PTT(1);
+            STATS_COUNT(STAT_PTT_CYCLES);
+#if XCVR_STATS
+            ptt_up_time = millis();
+#endif
+            break;
+        case QSK_SYNTH_TRANSMIT:
+            if (KEYER_OUTPUTS_LIVE) {
+                transceiver->key();
             }
-          }
-          break;
-        case DIT_CLOSURE_DAH_ON:
-          if (dit_buffer) {
-            if (dah_buffer) {
-              dah_buffer = 0;
-            } else {
-              last_closure = DIT_CLOSURE_DAH_OFF;
+            break;
+        case QSK_KEY_ON:
+            if (KEYER_OUTPUTS_LIVE) {
+                digitalWrite(tx_key_line_1, HIGH);
             }
-          } else {
-            if (dah_buffer) {
-              last_closure = DAH_CLOSURE_DIT_OFF;
-            } else {
-              last_closure = NO_CLOSURE;
+            TRACE_OUTPUT(TRACE_KEY_LINE, HIGH);
+            key_to_rf_micros = micros() - qsk_started;
+            PROFILE_RECORD(PROBE_KEY_TO_RF, key_to_rf_micros);
+            break;
+        case QSK_FIRST_EXTENSION:
+            if (first_extension_time) {
+                delay(first_extension_time);
             }
-          }
-          break;
-
-        case DAH_CLOSURE_DIT_OFF:
-          if (dit_buffer) {
-            if (dah_buffer) {
-              last_closure = DIT_CLOSURE_DAH_ON;
-              dah_buffer = 0;
-            } else {
-              last_closure = DIT_CLOSURE_DAH_OFF;
+            break;
+        case QSK_SIDETONE_ON:
+            if (configuration.sidetone_mode == SIDETONE_ON || configuration.sidetone_mode == SIDETONE_PADDLE_ONLY) {
+                tone(sidetone_line, configuration.hz_sidetone);
             }
-          } else {
-            if (!dah_buffer) {
-              last_closure = NO_CLOSURE;
+            break;
+        case QSK_KEY_OFF:
+            if (KEYER_OUTPUTS_LIVE) {
+                digitalWrite(tx_key_line_1, LOW);
             }
-          }
-          break;
-
-        case DAH_CLOSURE_DIT_ON:
-          if (dah_buffer) {
-            if (dit_buffer) {
-              dit_buffer = 0;
-            } else {
-              last_closure = DAH_CLOSURE_DIT_OFF;
+            TRACE_OUTPUT(TRACE_KEY_LINE, LOW);
+            break;
+        case QSK_SIDETONE_OFF:
+            if (configuration.sidetone_mode == SIDETONE_ON || configuration.sidetone_mode == SIDETONE_PADDLE_ONLY) {
+                noTone(sidetone_line);
             }
-          } else {
-            if (dit_buffer) {
-              last_closure = DIT_CLOSURE_DAH_OFF;
-            } else {
-              last_closure = NO_CLOSURE;
+            break;
+        case QSK_SYNTH_RECEIVE:
+            if (KEYER_OUTPUTS_LIVE) {
+                transceiver->unkey();
             }
-          }
-          break;
-
-        case NO_CLOSURE:
-          if ((dit_buffer) && (!dah_buffer)) {
-            last_closure = DIT_CLOSURE_DAH_OFF;
-          } else {
-            if ((dah_buffer) && (!dit_buffer)) {
-              last_closure = DAH_CLOSURE_DIT_OFF;
-            } else {
-              if ((dit_buffer) && (dah_buffer)) {
-                // need to handle dit/dah priority here
-                last_closure = DIT_CLOSURE_DAH_ON;
-                dah_buffer = 0;
-              }
+            break;
+        case QSK_PTT_OFF:
+            if (KEYER_OUTPUTS_LIVE) {
+                digitalWrite(ptt_tx_1, LOW);
             }
-          }
-          break;
-      }
-    } else {
-     if ((dit_buffer) && (dah_buffer)) {   // dit or dah priority mode
-       if (ultimatic_mode == ULTIMATIC_DIT_PRIORITY) {
-         dah_buffer = 0;
-       } else {
-         dit_buffer = 0;
-       }
-     }
+            TRACE_OUTPUT(TRACE_PTT, LOW);
+            ptt_line_activated = 0;
+            KEYER_BENCHMARK_PTT(0);
+            STATS_ADD(STAT_TX_MILLISECONDS, millis() - ptt_up_time);
+            rf_to_receive_micros = micros() - qsk_started;
+            PROFILE_RECORD(PROBE_RF_TO_RECEIVE, rf_to_receive_micros);
+            break;
+        default:
+            break;
     }
-  }
 }
 
 //-------------------------------------------------------------------------------------------------------
 
-void Keyer::ptt_key() {
-    if (ptt_line_activated == 0) {   // if PTT is currently deactivated, bring it up and insert PTT lead time delay
-        digitalWrite(ptt_tx_1, HIGH);
-        // we need to make this as fast as possible, otherwise a delay will be audible between first impulse and the rest
-        transceiver->key();
-        // had to comment out the line below this because setting the TX frequency above introduces too much delay 
-        // delay(ptt_lead_time);
-        ptt_line_activated = 1;
-    }
-    ptt_time = millis();
-}
-
-//-------------------------------------------------------------------------------------------------------
 void Keyer::ptt_unkey() {
     if (ptt_line_activated) {
-        digitalWrite (ptt_tx_1, LOW);
-        ptt_line_activated = 0;
-        transceiver->unkey();
+        QSK_RUN(qskToReceive);
     }
 }
 
@@ -728,7 +2455,7 @@ void Keyer::check_ptt_tail() {
         if (ptt_line_activated && manual_ptt_invoke == 0) {
             //if ((millis() - ptt_time) > ptt_tail_time) {
             if (last_sending_type == MANUAL_SENDING) {
-                if ((millis() - ptt_time) >= ((configuration.length_wordspace*ptt_hang_time_wordspace_units)*float(1200/configuration.wpm)) ) {
+                if ((millis() - ptt_time) >= timing.ptt_hang) {
                     ptt_unkey();
                 }          
             } else {
@@ -766,25 +2493,23 @@ void Keyer::send_dit(byte sending_type) {
   // notes: key_compensation is a straight x mS lengthening or shortening of the key down time
   //        weighting is
 
-  unsigned int character_wpm = configuration.wpm;
-
   being_sent = SENDING_DIT;
   tx_and_sidetone_key(1,sending_type);
-  if ((tx_key_dit) && (key_tx)) {digitalWrite(tx_key_dit,HIGH);}
+  if ((tx_key_dit) && (key_tx) && KEYER_OUTPUTS_LIVE) {digitalWrite(tx_key_dit,HIGH);}
 
-  loop_element_lengths((1.0*(float(configuration.weighting)/50)),keying_compensation,character_wpm,sending_type);
+  loop_element_micros(timing.dit_on);
   
-  if ((tx_key_dit) && (key_tx)) {digitalWrite(tx_key_dit,LOW);}
+  if ((tx_key_dit) && (key_tx) && KEYER_OUTPUTS_LIVE) {digitalWrite(tx_key_dit,LOW);}
   tx_and_sidetone_key(0,sending_type);
 
-  loop_element_lengths((2.0-(float(configuration.weighting)/50)),(-1.0*keying_compensation),character_wpm,sending_type);
+  loop_element_micros(timing.dit_off);
 
   // autospace
-  if ((sending_type == MANUAL_SENDING) && (configuration.autospace_active)) {
+  if ((sending_type == MANUAL_SENDING) && (timing.autospace)) {
     check_paddles();
   }
-  if ((sending_type == MANUAL_SENDING) && (configuration.autospace_active) && (dit_buffer == 0) && (dah_buffer == 0)) {
-    loop_element_lengths(2,0,configuration.wpm,sending_type);
+  if ((sending_type == MANUAL_SENDING) && (timing.autospace) && (dit_buffer == 0) && (dah_buffer == 0)) {
+    loop_element_micros(timing.autospace);
   }
 
   being_sent = SENDING_NOTHING;
@@ -796,26 +2521,24 @@ void Keyer::send_dit(byte sending_type) {
 //-------------------------------------------------------------------------------------------------------
 
 void Keyer::send_dah(byte sending_type) {
-  unsigned int character_wpm = configuration.wpm;
-
   being_sent = SENDING_DAH;
   tx_and_sidetone_key(1,sending_type);
-  if ((tx_key_dah) && (key_tx)) {digitalWrite(tx_key_dah,HIGH);}
+  if ((tx_key_dah) && (key_tx) && KEYER_OUTPUTS_LIVE) {digitalWrite(tx_key_dah,HIGH);}
 
-  loop_element_lengths((float(configuration.dah_to_dit_ratio/100.0)*(float(configuration.weighting)/50)),keying_compensation,character_wpm,sending_type);
+  loop_element_micros(timing.dah_on);
 
-  if ((tx_key_dah) && (key_tx)) {digitalWrite(tx_key_dah,LOW);}
+  if ((tx_key_dah) && (key_tx) && KEYER_OUTPUTS_LIVE) {digitalWrite(tx_key_dah,LOW);}
 
   tx_and_sidetone_key(0,sending_type);
 
-  loop_element_lengths((4.0-(3.0*(float(configuration.weighting)/50))),(-1.0*keying_compensation),character_wpm,sending_type);
+  loop_element_micros(timing.dah_off);
 
   // autospace
-  if ((sending_type == MANUAL_SENDING) && (configuration.autospace_active)) {
+  if ((sending_type == MANUAL_SENDING) && (timing.autospace)) {
     check_paddles();
   }
-  if ((sending_type == MANUAL_SENDING) && (configuration.autospace_active) && (dit_buffer == 0) && (dah_buffer == 0)) {
-    loop_element_lengths(2,0,configuration.wpm,sending_type);
+  if ((sending_type == MANUAL_SENDING) && (timing.autospace) && (dit_buffer == 0) && (dah_buffer == 0)) {
+    loop_element_micros(timing.autospace);
   }
 
 //  if ((keyer_mode == IAMBIC_A) && (iambic_flag)) {
@@ -834,49 +2557,62 @@ void Keyer::send_dah(byte sending_type) {
 
 void Keyer::tx_and_sidetone_key(int state, byte sending_type) {
     if (state && key_state == 0) {
+        if (!key_tx) {
+            QSK_RUN(qskSidetoneOn);
+        } else if (ptt_line_activated) {
+            QSK_RUN(qskKeyDown);
+        } else {
+            QSK_RUN(qskToTransmit);
+        }
+        ptt_time = millis();
+        key_state = 1;
         if (key_tx) {
-            byte previous_ptt_line_activated = ptt_line_activated;
-            ptt_key();
-            digitalWrite(tx_key_line_1, HIGH);
-            if ((first_extension_time) && (previous_ptt_line_activated == 0)) {
-                delay(first_extension_time);
-            }
+            STATS_COUNT(STAT_KEY_DOWNS);
         }
-
-        if (configuration.sidetone_mode == SIDETONE_ON || configuration.sidetone_mode == SIDETONE_PADDLE_ONLY) {
-            tone(sidetone_line, configuration.hz_sidetone);
+        // a space longer than the one between elements starts another character
+        if (key_up_time == 0 || (millis() - key_up_time) > timing.character_gap) {
+            STATS_COUNT(STAT_CHARACTERS + constrain(configuration.keyer_mode, STRAIGHT, TUNING) - STRAIGHT);
         }
-        key_state = 1;
+        KEYER_BENCHMARK_KEY(1, being_sent);
+#if XCVR_PROFILING
+        // only spaces inside a character are timed by the keyer, longer ones are up to the operator
+        unsigned long space = profilerNow() - key_up_micros;
+        if (key_up_micros != 0 && space < expected_space_micros + 1200000UL / configuration.wpm) {
+            PROFILE_RECORD(PROBE_KEY_SPACE_ERROR, space > expected_space_micros ? space - expected_space_micros : expected_space_micros - space);
+        }
+#endif
     } else {
         if (state == 0 && key_state) {
             if (key_tx) {
-                digitalWrite (tx_key_line_1, LOW);
-                ptt_key();
-            }
-            if (configuration.sidetone_mode == SIDETONE_ON || configuration.sidetone_mode == SIDETONE_PADDLE_ONLY) {
-                noTone(sidetone_line);
+                QSK_RUN(qskKeyUp);
+                ptt_time = millis();
+            } else {
+                QSK_RUN(qskSidetoneOff);
             }
             key_state = 0;
+            KEYER_BENCHMARK_KEY(0, being_sent);
+            key_up_time = millis();
+#if XCVR_PROFILING
+            // the space send_dit()/send_dah() is about to wait for
+            key_up_micros = profilerNow();
+            expected_space_micros = being_sent == SENDING_DAH ? timing.dah_off : timing.dit_off;
+#endif
         }
     }
 }
 
 //-------------------------------------------------------------------------------------------------------
 
-void Keyer::loop_element_lengths(float lengths, float additional_time_ms, int speed_wpm_in, byte sending_type) {
+void Keyer::loop_element_micros(unsigned long duration) {
 
-  if ((lengths == 0) or (lengths < 0)) {
+  if (duration == 0) {
     return;
   }
 
-  float element_length;
-
-  element_length = 1200/speed_wpm_in;
-
-  unsigned long endtime = micros() + long(element_length*lengths*1000) + long(additional_time_ms*1000);
-  while ((micros() < endtime) && (micros() > 200000)) {  // the second condition is to account for millis() rollover
-    if (configuration.keyer_mode != ULTIMATIC) {
-      if ((configuration.keyer_mode == IAMBIC_A) && (paddle_pin_read(paddle_left) == LOW ) && (paddle_pin_read(paddle_right) == LOW )) {
+  unsigned long start = micros();
+  while ((micros() - start) < duration) {
+    if (!is_keyer_mode(ULTIMATIC)) {
+      if ((is_keyer_mode(IAMBIC_A)) && (paddle_pin_read(paddle_left) == LOW ) && (paddle_pin_read(paddle_right) == LOW )) {
           iambic_flag = 1;
       }    
   
@@ -887,17 +2623,65 @@ void Keyer::loop_element_lengths(float lengths, float additional_time_ms, int sp
           check_dit_paddle();
         }
       }
-    } //while ((millis() < endtime) && (millis() > 200))
+    }
   }   
 
-  if ((configuration.keyer_mode == IAMBIC_A) && (iambic_flag) && (paddle_pin_read(paddle_left) == HIGH ) && (paddle_pin_read(paddle_right) == HIGH )) {
+  if ((is_keyer_mode(IAMBIC_A)) && (iambic_flag) && (paddle_pin_read(paddle_left) == HIGH ) && (paddle_pin_read(paddle_right) == HIGH )) {
       iambic_flag = 0;
       dit_buffer = 0;
       dah_buffer = 0;
   }    
-} //void loop_element_lengths
+} //void loop_element_micros
+
+//-------------------------------------------------------------------------------------------------------
+
+// A negative duration, from heavy weighting or keying compensation, is no wait at all.
+static unsigned long element_micros(long duration) {
+  return duration > 0 ? duration : 0;
+}
+
+void Keyer::compute_timing() {
+  long unit = 1200000L / configuration.wpm;
+  long weighting = configuration.weighting;
+  long compensation = keying_compensation * 1000L;
+
+  timing.dit_on = element_micros(unit * weighting / 50 + compensation);
+  timing.dit_off = element_micros(unit * (100 - weighting) / 50 - compensation);
+  timing.dah_on = element_micros((unit * configuration.dah_to_dit_ratio / 100) * weighting / 50 + compensation);
+  timing.dah_off = element_micros(unit * (200 - 3 * weighting) / 50 - compensation);
+
+  unsigned long letterspace = unit * length_letterspace;
+  unsigned long wordspace = unit * configuration.length_wordspace;
+  bool farnsworth = configuration.farnsworth_wpm != 0 && configuration.farnsworth_wpm < configuration.wpm;
+  if (farnsworth) {
+    float c = configuration.wpm;
+    float s = configuration.farnsworth_wpm;
+    float stretched = (60.0 * c - 37.2 * s) * 1000000.0 / (s * c);
+    letterspace = stretched * 3 / 19;
+    wordspace = stretched * 7 / 19;
+  }
+  // the space after an element already is one unit of the letter space
+  timing.autospace = (configuration.autospace_active || farnsworth) ? letterspace - unit : 0;
+  timing.letterspace = letterspace / 1000;
+  timing.character_gap = 2 * 1200UL / configuration.wpm;
+  timing.ptt_hang = wordspace / 1000 * ptt_hang_time_wordspace_units;
+}
+
 
 
+
+//-------------------------------------------------------------------------------------------------------
+
+void Keyer::next_keyer_mode() {
+  do {
+    configuration.keyer_mode++;
+    if (configuration.keyer_mode > TUNING) {
+      configuration.keyer_mode = STRAIGHT;
+    }
+  } while (!KEYER_MODE_ENABLED(configuration.keyer_mode));
+  publish_state(STATE_BIT(STATE_KEYER_MODE));
+}
+
 //-------------------------------------------------------------------------------------------------------
 
 void Keyer::speed_change(int change) {
@@ -908,14 +2692,20 @@ void Keyer::speed_change(int change) {
 
 void Keyer::speed_set(int wpm_set) {
   configuration.wpm = wpm_set;
-  config_dirty = 1;
+  compute_timing();
+  publish_state(STATE_BIT(STATE_WPM));
+}
+
+void Keyer::farnsworth_set(byte wpm_set) {
+  configuration.farnsworth_wpm = wpm_set;
+  compute_timing();
+  publish_state(STATE_BIT(STATE_WPM));
 }
 //-------------------------------------------------------------------------------------------------------
 
 void Keyer::sidetone_adj(int hz) {
   if ((configuration.hz_sidetone + hz) > SIDETONE_HZ_LOW_LIMIT && (configuration.hz_sidetone + hz) < SIDETONE_HZ_HIGH_LIMIT) {
     configuration.hz_sidetone = configuration.hz_sidetone + hz;
-    config_dirty = 1;
   }
 }
 
@@ -924,8 +2714,8 @@ void Keyer::sidetone_adj(int hz) {
 
 void Keyer::service_dit_dah_buffers() {
 
-  if (configuration.keyer_mode == IAMBIC_A || configuration.keyer_mode == IAMBIC_B || configuration.keyer_mode == ULTIMATIC) {
-    if ((configuration.keyer_mode == IAMBIC_A) && (iambic_flag) && (paddle_pin_read(paddle_left)) && (paddle_pin_read(paddle_right))) {
+  if (is_keyer_mode(IAMBIC_A) || is_keyer_mode(IAMBIC_B) || is_keyer_mode(ULTIMATIC)) {
+    if ((is_keyer_mode(IAMBIC_A)) && (iambic_flag) && (paddle_pin_read(paddle_left)) && (paddle_pin_read(paddle_right))) {
       iambic_flag = 0;
       dit_buffer = 0;
       dah_buffer = 0;
@@ -940,7 +2730,7 @@ void Keyer::service_dit_dah_buffers() {
       }
     }
   } else {
-    if (configuration.keyer_mode == BUG) {
+    if (is_keyer_mode(BUG)) {
       if (dit_buffer) {
         dit_buffer = 0;
         send_dit(MANUAL_SENDING);
@@ -952,7 +2742,7 @@ void Keyer::service_dit_dah_buffers() {
         tx_and_sidetone_key(0,MANUAL_SENDING);
       }
     } else {
-      if (configuration.keyer_mode == STRAIGHT) {
+      if (is_keyer_mode(STRAIGHT)) {
         if (dit_buffer) {
           dit_buffer = 0;
           tx_and_sidetone_key(1,MANUAL_SENDING);
@@ -960,7 +2750,7 @@ void Keyer::service_dit_dah_buffers() {
           tx_and_sidetone_key(0,MANUAL_SENDING);
         }
       } else {
-        if (configuration.keyer_mode == TUNING) {
+        if (is_keyer_mode(TUNING)) {
             if (dah_buffer) {
                 // dah_buffer = 0;
                 tx_and_sidetone_key(0, MANUAL_SENDING);
@@ -1005,17 +2795,695 @@ void Keyer::boop_beep() {
 }
 
 int Keyer::paddle_pin_read(int pin_to_read) {
+#if XCVR_KEYER_BENCHMARK
+  if (KeyerBenchmark::active) {
+    return KeyerBenchmark::paddleLevel(pin_to_read);
+  }
+#endif
+#if XCVR_TRACE == TRACE_REPLAY
+  return Trace::paddleLevel(pin_to_read);
+#elif XCVR_TRACE == TRACE_RECORD
+  byte level = digitalRead(pin_to_read);
+  byte index = (pin_to_read == paddle_left) ? 0 : 1;
+  if (level != last_paddle_level[index]) {
+    last_paddle_level[index] = level;
+    Trace::record(index == 0 ? TRACE_PADDLE_DIT : TRACE_PADDLE_DAH, level);
+  }
+  return level;
+#else
   return digitalRead(pin_to_read);
+#endif
 }
 
 void Keyer::init() {
   initialize_pins();
   initialize_keyer_state();
   initialize_default_modes();
+  publish_state(STATE_BIT(STATE_WPM) | STATE_BIT(STATE_KEYER_MODE));
+}
+
+void Keyer::publish_state(unsigned short fields) {
+  RadioState& state = radioState.edit();
+  state.wpm = configuration.wpm;
+  state.effectiveWpm = (configuration.farnsworth_wpm != 0 && configuration.farnsworth_wpm < configuration.wpm) ?
+                            configuration.farnsworth_wpm : configuration.wpm;
+  state.keyerMode = configuration.keyer_mode;
+  radioState.publish(fields);
+}
+
+// true while nothing is being keyed and no element is about to be, so that slow work
+// like redrawing the display cannot stretch an element space
+bool Keyer::idle_window() {
+    if (key_state || dit_buffer || dah_buffer) {
+        return false;
+    }
+    if (paddle_pin_read(paddle_left) == LOW || paddle_pin_read(paddle_right) == LOW) {
+        return false;
+    }
+    if (!ptt_line_activated) {
+        return true;
+    }
+    // a letter space already allows for some slack
+    return (millis() - key_up_time) >= timing.letterspace;
 }
 
 void Keyer::update() {
+    PROFILE_SCOPE(PROBE_KEYER_UPDATE);
     check_paddles();
     service_dit_dah_buffers();
     check_ptt_tail();
 }
+
+
+// ----------------------------------------------------------------------------------
+
+#if XCVR_PROFILING
+
+Profiler::Stats Profiler::stats[PROBE_COUNT];
+volatile unsigned long Profiler::interruptMicros = 0;
+unsigned long Profiler::since = 0;
+
+static const char probeNames[] PROGMEM = "LOOP KEYER UI RENDER SYNTH MCP STALE SPACE KEYRF RFRX TIMER METER";
+
+void Profiler::record(byte probe, unsigned long elapsed) {
+    Stats& s = stats[probe];
+    if (s.count == 0 || elapsed < s.min) {
+        s.min = elapsed;
+    }
+    if (elapsed > s.max) {
+        s.max = elapsed;
+    }
+    s.sum += elapsed;
+    s.count++;
+
+    byte bucket = 0;
+    for (unsigned long rest = elapsed >> 3; rest != 0 && bucket < PROFILE_BUCKETS - 1; rest >>= 1) {
+        bucket++;
+    }
+    if (s.buckets[bucket] != 0xFFFF) {
+        s.buckets[bucket]++;
+    }
+
+    // keep the mean meaningful instead of letting count or sum wrap around
+    if (s.count == 0xFFFF || s.sum > 0x7FFFFFFFUL) {
+        s.sum >>= 1;
+        s.count >>= 1;
+    }
+}
+
+void Profiler::reset() {
+    memset(stats, 0, sizeof(stats));
+    interruptMicros = 0;
+    since = profilerNow();
+}
+
+void Profiler::dump() {
+    char buffer[12];
+    const char* name = probeNames;
+    for (byte i = 0; i < PROBE_COUNT; i++) {
+        Stats& s = stats[i];
+        Serial.print(F("PRF "));
+        char c;
+        while ((c = pgm_read_byte(name++)) != ' ' && c != '\0') {
+            Serial.write(c);
+        }
+        Serial.print(F(" N"));
+        Serial.write(ultoa(s.count, buffer, 10));
+        Serial.print(F(" MIN"));
+        Serial.write(ultoa(s.min, buffer, 10));
+        Serial.print(F(" MAX"));
+        Serial.write(ultoa(s.max, buffer, 10));
+        Serial.print(F(" AVG"));
+        Serial.write(ultoa(s.count ? s.sum / s.count : 0, buffer, 10));
+        Serial.print(F(" H"));
+        for (byte b = 0; b < PROFILE_BUCKETS; b++) {
+            if (b > 0) {
+                Serial.print(F(","));
+            }
+            Serial.write(ultoa(s.buckets[b], buffer, 10));
+        }
+        Serial.print(F("\n"));
+    }
+
+    // the timer interrupt's share of the CPU, in tenths of a percent
+    unsigned long elapsed = (profilerNow() - since) / 1000;
+    byte sreg = SREG;
+    cli();
+    unsigned long busy = interruptMicros;
+    SREG = sreg;
+    Serial.print(F("PRF CPU TIMER"));
+    Serial.write(ultoa(elapsed ? busy / elapsed : 0, buffer, 10));
+    Serial.print(F("\n"));
+}
+
+#endif
+
+
+// ----------------------------------------------------------------------------------
+
+#if XCVR_TRACE != TRACE_OFF
+
+unsigned long Trace::lastRecordTime = 0;
+
+void Trace::writeHeader(byte type, byte value) {
+    unsigned long now = millis();
+    unsigned long delta = now - lastRecordTime;
+    if (delta > 0xFFFF) {
+        delta = 0xFFFF; // longer pauses get shortened, nothing happens during them anyway
+    }
+    lastRecordTime = now;
+
+    byte header[5] = {TRACE_SYNC, type, value, (byte) delta, (byte) (delta >> 8)};
+    Serial.write(header, sizeof(header));
+}
+
+void Trace::record(byte type, byte value) {
+    writeHeader(type, value);
+}
+
+void Trace::record(byte type, byte value, unsigned long payload) {
+    writeHeader(type, value);
+    byte data[4] = {(byte) payload, (byte) (payload >> 8), (byte) (payload >> 16), (byte) (payload >> 24)};
+    Serial.write(data, sizeof(data));
+}
+
+void Trace::recordInput(byte type, short value) {
+    if (hasPayload(type)) {
+        record(type, 0, (long) value);
+    } else {
+        record(type, value);
+    }
+}
+
+#if XCVR_TRACE == TRACE_REPLAY
+
+byte Trace::received[8];
+byte Trace::receivedLength = 0;
+bool Trace::pending = false;
+unsigned long Trace::nextEventTime = 0;
+byte Trace::ditLevel = HIGH;
+byte Trace::dahLevel = HIGH;
+byte Trace::modeLevel = HIGH;
+bool Trace::modeEdge = false;
+short Trace::encoderDelta = 0;
+byte Trace::encoderButtonLevel = HIGH;
+bool Trace::encoderButtonEdge = false;
+
+void Trace::service() {
+    static bool started = false;
+
+    for (;;) {
+        while (!pending && Serial.available() > 0) {
+            byte c = Serial.read();
+            if (receivedLength == 0 && c != TRACE_SYNC) {
+                continue; // not inside a record
+            }
+            received[receivedLength++] = c;
+
+            byte recordLength = (receivedLength > 1 && hasPayload(received[1])) ? 9 : 5;
+            if (receivedLength == recordLength) {
+                if (!started) {
+                    nextEventTime = millis();
+                    started = true;
+                }
+                nextEventTime += received[3] | (received[4] << 8);
+                receivedLength = 0;
+                pending = true;
+            }
+        }
+
+        if (!pending || (long) (millis() - nextEventTime) < 0) {
+            return;
+        }
+        apply();
+        pending = false;
+    }
+}
+
+void Trace::apply() {
+    byte value = received[2];
+    switch (received[1]) {
+        case TRACE_ENCODER_DELTA:
+            encoderDelta += (short) (received[5] | (received[6] << 8));
+            break;
+        case TRACE_ENCODER_BUTTON:
+            encoderButtonLevel = value;
+            encoderButtonEdge = true;
+            break;
+        case TRACE_MODE_BUTTON:
+            modeLevel = value;
+            modeEdge = true;
+            break;
+        case TRACE_PADDLE_DIT:
+            ditLevel = value;
+            break;
+        case TRACE_PADDLE_DAH:
+            dahLevel = value;
+            break;
+        default:
+            break; // recorded outputs are not replayed
+    }
+}
+
+byte Trace::paddleLevel(byte pin) {
+    service();
+    return pin == paddle_left ? ditLevel : dahLevel;
+}
+
+short Trace::takeEncoderDelta() {
+    short delta = encoderDelta;
+    encoderDelta = 0;
+    return delta;
+}
+
+bool Trace::takeEncoderButtonEdge(byte& level) {
+    if (!encoderButtonEdge) {
+        return false;
+    }
+    level = encoderButtonLevel;
+    encoderButtonEdge = false;
+    return true;
+}
+
+bool Trace::takeModeButtonEdge(byte& level) {
+    if (!modeEdge) {
+        return false;
+    }
+    level = modeLevel;
+    modeEdge = false;
+    return true;
+}
+
+#endif
+
+#endif
+
+
+// ----------------------------------------------------------------------------------
+
+#if XCVR_KEYER_BENCHMARK
+
+enum BenchmarkPattern {
+    PATTERN_DITS = 0,
+    PATTERN_DAHS,
+    PATTERN_SQUEEZE,
+    PATTERN_COUNT
+};
+
+struct BenchmarkSegment {
+    byte units; // length in dits
+    byte dit;   // paddle levels, LOW = closed
+    byte dah;
+};
+
+// every pattern ends with a short dah tap, which is what releases the key in TUNING mode
+#define BENCHMARK_SEGMENTS 4
+static const BenchmarkSegment benchmarkScripts[PATTERN_COUNT][BENCHMARK_SEGMENTS] = {
+    {{8, LOW, HIGH}, {4, HIGH, HIGH}, {1, HIGH, LOW}, {10, HIGH, HIGH}},
+    {{8, HIGH, LOW}, {4, HIGH, HIGH}, {1, HIGH, LOW}, {10, HIGH, HIGH}},
+    {{8, LOW, LOW},  {4, HIGH, HIGH}, {1, HIGH, LOW}, {10, HIGH, HIGH}}
+};
+
+static const byte benchmarkModes[] = {STRAIGHT, IAMBIC_A, IAMBIC_B, BUG, ULTIMATIC, TUNING};
+static const byte benchmarkSpeeds[] = {5, 10, 20, 30, 45, 60};
+
+static const struct {
+    byte weighting;
+    unsigned int dahToDitRatio;
+    byte keyingCompensation;
+} benchmarkSettings[] = {
+    {50, 300, 0},
+    {60, 300, 0},
+    {50, 350, 0},
+    {50, 300, 5}
+};
+
+bool KeyerBenchmark::active = false;
+KeyerBenchmark::ErrorStats KeyerBenchmark::dits;
+KeyerBenchmark::ErrorStats KeyerBenchmark::dahs;
+KeyerBenchmark::ErrorStats KeyerBenchmark::gaps;
+KeyerBenchmark::ErrorStats KeyerBenchmark::latencies;
+unsigned long KeyerBenchmark::unit;
+unsigned long KeyerBenchmark::scriptStart;
+byte KeyerBenchmark::pattern;
+long KeyerBenchmark::ditOn;
+long KeyerBenchmark::dahOn;
+long KeyerBenchmark::ditOff;
+long KeyerBenchmark::dahOff;
+long KeyerBenchmark::expectedGap;
+unsigned long KeyerBenchmark::keyDownTime;
+unsigned long KeyerBenchmark::keyUpTime;
+unsigned long KeyerBenchmark::pttUpTime;
+unsigned long KeyerBenchmark::pttLead;
+unsigned long KeyerBenchmark::pttTail;
+byte KeyerBenchmark::keyDownSending;
+
+static void writeBenchmarkField(long value) {
+    char buffer[12];
+    Serial.print(F(","));
+    Serial.write(ltoa(value, buffer, 10));
+}
+
+void KeyerBenchmark::ErrorStats::add(long error) {
+    if (count == 0 || error < min) {
+        min = error;
+    }
+    if (count == 0 || error > max) {
+        max = error;
+    }
+    sum += error;
+    count++;
+}
+
+void KeyerBenchmark::ErrorStats::write() {
+    writeBenchmarkField(count);
+    writeBenchmarkField(count ? sum / (long) count : 0);
+    writeBenchmarkField(max - min);
+}
+
+void KeyerBenchmark::run(Keyer& keyer, byte onlyWpm) {
+    Keyer::config_t savedConfiguration = keyer.configuration;
+    byte savedKeyingCompensation = keyer.keying_compensation;
+    byte savedKeyTx = keyer.key_tx;
+    keyer.key_tx = 1; // for the PTT timing, KEYER_OUTPUTS_LIVE keeps the rig in receive
+
+    Serial.print(F("KBM,mode,wpm,weighting,ratio,compensation,pattern,"
+                   "dits,dit_error,dit_jitter,dahs,dah_error,dah_jitter,gaps,gap_error,gap_jitter,"
+                   "manual_edges,latency,latency_jitter,ptt_lead,ptt_tail_error\n"));
+
+    for (byte m = 0; m < sizeof(benchmarkModes); m++) {
+        if (!KEYER_MODE_ENABLED(benchmarkModes[m])) {
+            continue;
+        }
+        for (byte w = 0; w < sizeof(benchmarkSpeeds); w++) {
+            if (onlyWpm != 0 && benchmarkSpeeds[w] != onlyWpm) {
+                continue;
+            }
+            for (byte s = 0; s < sizeof(benchmarkSettings) / sizeof(benchmarkSettings[0]); s++) {
+                for (byte p = 0; p < PATTERN_COUNT; p++) {
+                    runOnce(keyer, benchmarkModes[m], benchmarkSpeeds[w], s, p);
+                }
+            }
+        }
+    }
+
+    keyer.configuration = savedConfiguration;
+    keyer.keying_compensation = savedKeyingCompensation;
+    keyer.key_tx = savedKeyTx;
+    keyer.compute_timing();
+    keyer.publish_state(STATE_BIT(STATE_WPM) | STATE_BIT(STATE_KEYER_MODE));
+}
+
+void KeyerBenchmark::runOnce(Keyer& keyer, byte mode, byte wpm, byte setting, byte pattern) {
+    keyer.configuration.keyer_mode = mode;
+    keyer.configuration.wpm = wpm;
+    keyer.configuration.farnsworth_wpm = 0; // the ideal timing below is without it
+    keyer.configuration.weighting = benchmarkSettings[setting].weighting;
+    keyer.configuration.dah_to_dit_ratio = benchmarkSettings[setting].dahToDitRatio;
+    keyer.keying_compensation = benchmarkSettings[setting].keyingCompensation;
+    keyer.compute_timing();
+    keyer.dit_buffer = 0;
+    keyer.dah_buffer = 0;
+    keyer.iambic_flag = 0;
+
+    // the ideal timing, unclamped, against which the precomputed waits are measured
+    unit = 1200000UL / wpm;
+    long weighting = keyer.configuration.weighting;
+    long compensation = keyer.keying_compensation * 1000L;
+    ditOn = unit * weighting / 50 + compensation;
+    dahOn = (unit * keyer.configuration.dah_to_dit_ratio / 100) * weighting / 50 + compensation;
+    ditOff = unit * (100 - weighting) / 50 - compensation;
+    dahOff = unit * (200 - 3 * weighting) / 50 - compensation;
+
+    memset(&dits, 0, sizeof(dits));
+    memset(&dahs, 0, sizeof(dahs));
+    memset(&gaps, 0, sizeof(gaps));
+    memset(&latencies, 0, sizeof(latencies));
+    keyDownTime = keyUpTime = pttUpTime = pttLead = pttTail = 0;
+    keyDownSending = SENDING_NOTHING;
+    KeyerBenchmark::pattern = pattern;
+
+    unsigned long scriptLength = 0;
+    for (byte i = 0; i < BENCHMARK_SEGMENTS; i++) {
+        scriptLength += benchmarkScripts[pattern][i].units * unit;
+    }
+    unsigned long hangTime = keyer.configuration.length_wordspace * unit;
+
+    active = true;
+    scriptStart = micros();
+    while ((micros() - scriptStart) < scriptLength
+           || ((keyer.key_state || keyer.ptt_line_activated) && (micros() - scriptStart) < scriptLength + 2 * hangTime)) {
+        keyer.update();
+    }
+    active = false;
+
+    Serial.print(F("KBM"));
+    writeBenchmarkField(mode);
+    writeBenchmarkField(wpm);
+    writeBenchmarkField(keyer.configuration.weighting);
+    writeBenchmarkField(keyer.configuration.dah_to_dit_ratio);
+    writeBenchmarkField(keyer.keying_compensation);
+    writeBenchmarkField(pattern);
+    dits.write();
+    dahs.write();
+    gaps.write();
+    latencies.write();
+    writeBenchmarkField(pttLead);
+    writeBenchmarkField(pttTail ? (long) pttTail - (long) hangTime : 0);
+    Serial.print(F("\n"));
+}
+
+byte KeyerBenchmark::currentSegment(unsigned long now) {
+    unsigned long elapsed = now - scriptStart;
+    for (byte i = 0; i < BENCHMARK_SEGMENTS; i++) {
+        unsigned long length = benchmarkScripts[pattern][i].units * unit;
+        if (elapsed < length) {
+            return i;
+        }
+        elapsed -= length;
+    }
+    return BENCHMARK_SEGMENTS;
+}
+
+byte KeyerBenchmark::paddleLevel(byte pin) {
+    byte segment = currentSegment(micros());
+    if (segment == BENCHMARK_SEGMENTS) {
+        return HIGH;
+    }
+    return pin == paddle_left ? benchmarkScripts[pattern][segment].dit : benchmarkScripts[pattern][segment].dah;
+}
+
+void KeyerBenchmark::keyEdge(byte state, byte sending) {
+    unsigned long now = micros();
+
+    if (sending == SENDING_NOTHING) {
+        // manually keyed, measure against the scripted paddle edge that caused it
+        unsigned long segmentStart = scriptStart;
+        byte segment = currentSegment(now);
+        for (byte i = 0; i < segment; i++) {
+            segmentStart += benchmarkScripts[pattern][i].units * unit;
+        }
+        latencies.add(now - segmentStart);
+    }
+
+    if (state) {
+        if (keyUpTime != 0 && keyDownSending != SENDING_NOTHING && sending != SENDING_NOTHING) {
+            long gap = now - keyUpTime;
+            if (gap < 3 * expectedGap) {
+                gaps.add(gap - expectedGap);
+            }
+        }
+        if (pttLead == 0 && pttUpTime != 0) {
+            pttLead = now - pttUpTime;
+        }
+        keyDownTime = now;
+        keyDownSending = sending;
+    } else {
+        long on = now - keyDownTime;
+        if (sending == SENDING_DIT) {
+            dits.add(on - ditOn);
+            expectedGap = ditOff;
+        } else if (sending == SENDING_DAH) {
+            dahs.add(on - dahOn);
+            expectedGap = dahOff;
+        }
+        keyUpTime = now;
+    }
+}
+
+void KeyerBenchmark::pttEdge(byte state) {
+    unsigned long now = micros();
+    if (state) {
+        if (pttUpTime == 0) {
+            pttUpTime = now;
+        }
+    } else if (keyUpTime != 0) {
+        pttTail = now - keyUpTime;
+    }
+}
+
+#endif
+
+
+// ----------------------------------------------------------------------------------
+
+#if XCVR_AUDIO_METER
+
+volatile short AudioMeter::coefficients[METER_FILTERS];
+short AudioMeter::s1[METER_FILTERS];
+short AudioMeter::s2[METER_FILTERS];
+volatile short AudioMeter::blockS1[METER_FILTERS];
+volatile short AudioMeter::blockS2[METER_FILTERS];
+volatile bool AudioMeter::blockReady = false;
+byte AudioMeter::count = 0;
+
+#ifdef ARDUINO
+ISR(ADC_vect) {
+#if XCVR_PROFILING
+    unsigned long start = profilerNow();
+    AudioMeter::sample(ADC);
+    PROFILE_RECORD(PROBE_METER_ISR, profilerNow() - start);
+#else
+    AudioMeter::sample(ADC);
+#endif
+}
+#endif
+
+void AudioMeter::init(word pitch) {
+    setPitch(pitch);
+
+    ADMUX = _BV(REFS0) | _BV(MUX1) | _BV(MUX0); // AVcc reference, A3
+    DIDR0 |= _BV(ADC3D);
+    ADCSRB = 0; // free running
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+void AudioMeter::setPitch(word pitch) {
+    short newCoefficients[METER_FILTERS];
+    for (byte i = 0; i < METER_FILTERS; i++) {
+        float frequency = pitch + ((char) i - METER_AT_PITCH) * METER_OFFSET_HZ;
+        newCoefficients[i] = 2.0 * cos(2.0 * M_PI * frequency / METER_SAMPLE_RATE) * (1 << METER_COEFFICIENT_BITS);
+    }
+    noInterrupts();
+    for (byte i = 0; i < METER_FILTERS; i++) {
+        coefficients[i] = newCoefficients[i];
+    }
+    interrupts();
+}
+
+void AudioMeter::sample(short value) {
+    short x = goertzel_input(value);
+    for (byte i = 0; i < METER_FILTERS; i++) {
+        goertzel_step(coefficients[i], x, s1[i], s2[i]);
+    }
+
+    if (++count == METER_BLOCK_SIZE) {
+        for (byte i = 0; i < METER_FILTERS; i++) {
+            blockS1[i] = s1[i];
+            blockS2[i] = s2[i];
+            s1[i] = 0;
+            s2[i] = 0;
+        }
+        count = 0;
+        blockReady = true;
+    }
+}
+
+// power = s1^2 + s2^2 - coefficient * s1 * s2, done here rather than in the interrupt
+bool AudioMeter::read(long power[METER_FILTERS]) {
+    if (!blockReady) {
+        return false;
+    }
+    short a[METER_FILTERS], b[METER_FILTERS], c[METER_FILTERS];
+    noInterrupts();
+    for (byte i = 0; i < METER_FILTERS; i++) {
+        a[i] = blockS1[i];
+        b[i] = blockS2[i];
+        c[i] = coefficients[i];
+    }
+    blockReady = false;
+    interrupts();
+
+    for (byte i = 0; i < METER_FILTERS; i++) {
+        power[i] = goertzel_power(c[i], a[i], b[i]);
+    }
+    return true;
+}
+
+#endif
+
+// ----------------------------------------------------------------------------------
+
+#if XCVR_RAM_REPORT
+
+// linker symbols of the sections, and malloc's top of the heap, 0 until the first allocation
+extern "C" {
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+extern char* __brkval;
+}
+
+// Runs from .init3, before .data and .bss are set up and without a stack frame of its own, and
+// fills everything between the end of .bss and the stack pointer with STACK_PAINT.
+extern "C" void paintStack() __attribute__((naked, used, section(".init3")));
+void paintStack() {
+    uint8_t* p = &_end;
+    while (p <= &__stack) {
+        *p++ = STACK_PAINT;
+    }
+}
+
+// the least free RAM there ever was between the heap and the stack since boot
+static unsigned int ramNeverUsed() {
+    uint8_t* p = __brkval != 0 ? (uint8_t*) __brkval : &__heap_start;
+    uint8_t* start = p;
+    while (p <= &__stack && *p == STACK_PAINT) {
+        p++;
+    }
+    return p - start;
+}
+
+static void writeRamField(const __FlashStringHelper* name, unsigned int value) {
+    char buffer[8];
+    Serial.print(name);
+    Serial.write(utoa(value, buffer, 10));
+}
+
+void XcvrUi::reportRam() {
+    uint8_t* heapEnd = __brkval != 0 ? (uint8_t*) __brkval : &__heap_start;
+    unsigned int free = ramNeverUsed();
+
+    writeRamField(F("RAM data="), &__data_end - &__data_start);
+    writeRamField(F(" bss="), &__bss_end - &__bss_start);
+    writeRamField(F(" heap="), heapEnd - &__heap_start);
+    writeRamField(F(" stack_max="), (&__stack - heapEnd) + 1 - free);
+    writeRamField(F(" free_min="), free);
+    Serial.write('\n');
+
+    // the objects behind the .bss figure, by subsystem
+    writeRamField(F("RAM xcvr="), sizeof(Xcvr));
+    writeRamField(F(" keyer="), sizeof(Keyer));
+    writeRamField(F(" ui="), sizeof(XcvrUi) + sizeof(uiText));
+    writeRamField(F(" display="), sizeof(U8GLIB) + 128 /* page buffer */
+#if XCVR_DISPLAY_HW_SPI
+                  + DISPLAY_QUEUE_SIZE
+#endif
+                  );
+    writeRamField(F(" encoder="), sizeof(ClickEncoder) + sizeof(InputEvent) * INPUT_QUEUE_SIZE);
+    writeRamField(F(" state="), sizeof(RadioStateStore));
+    writeRamField(F(" memories="), MemoryStore::ramUsage());
+#if XCVR_STATS
+    writeRamField(F(" stats="), OperatingStats::ramUsage());
+#endif
+#if XCVR_PROFILING
+    writeRamField(F(" profiler="), Profiler::ramUsage());
+#endif
+    Serial.write('\n');
+}
+
+#endif
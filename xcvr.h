@@ -9,15 +9,25 @@
 
 #define ENC_DECODER (1 << 2)
 #include <ClickEncoder.h>
-#include <Bounce2.h>  // https://github.com/thomasfredericks/Bounce2
+#include <EEPROM.h>
+#include <avr/sleep.h>
+#include <xcvr_paddles.h>
+#include <xcvr_goertzel.h>
+#include <xcvr_frequency.h>
 
 /**
 	Pins used:
- 		OLED display (SPI):
+ 		OLED display (software SPI, the default):
  			- 13 = SCK
- 			- 12 = MOSI 
- 			- 11 = MISO
- 			- 10 = SS
+ 			- 12 = MOSI
+ 			- 11 = D/C
+ 			- 10 = RESET
+
+ 		OLED display (hardware SPI, with XCVR_DISPLAY_HW_SPI):
+ 			- 13 = SCK
+ 			- 11 = MOSI
+ 			- 10 = RESET
+ 			- 9 = D/C
 
  		Optical encoder
  			- A0 = 
@@ -32,7 +42,7 @@
  			- A5 = I2C SCL
 
  		Band switching
- 			- will be done through the I2C port expander (4 bits)
+ 			- I2C port expander GPA0..GPB0, one pin per band (see bandPlan), GPB1 held low
 
  		Computer communication (Serial)
  			- 0 = TX
@@ -45,10 +55,15 @@
  			- 5 = PTT 
  			- 6 = SIDETONE
 
+ 		Audio (with XCVR_AUDIO_METER)
+ 			- A3 = receiver audio, biased to 2.5V
+
+ 		Mode button
+ 			- 8 = change ui mode
+
  		Free pins:
  			- 7
- 			- 8 = change ui mode
- 			- 9
+ 			- 9, with the software SPI display only
 
  */
 
@@ -67,18 +82,821 @@ enum XcvrStateFlags {
 	EXTERNAL_FILTERS_ON = 0x06
 };
 
+/**
+	Frequency arithmetic.
+
+	Every frequency is kept in Hz and only turned into the hundredths of Hz the Si5351 library
+	wants in Xcvr::writeSynth(). They are 64 bit numbers by default. Build with
+	XCVR_FREQUENCY_32BIT set to 1 to make them unsigned 32 bit numbers instead, which hold anything
+	the Si5351 can generate and spare the AVR the 64 bit math.
+ */
+#ifndef XCVR_FREQUENCY_32BIT
+#define XCVR_FREQUENCY_32BIT 0
+#endif
+
+#if XCVR_FREQUENCY_32BIT
+typedef unsigned long freq_t;
+#else
+typedef long long freq_t;
+#endif
+
 typedef struct Filter {
-	long long centerFrequency; // in Hz
+	freq_t centerFrequency; // in Hz
 	short int bandwidth; // in Hz
 };
 
+/**
+	Band plan.
+
+	The bands live in flash (bandPlan in xcvr.cpp), sorted by frequency, with the edges of the
+	IARU region selected by XCVR_IARU_REGION. Read them with Xcvr::getBandPlan().
+ */
+#ifndef XCVR_IARU_REGION
+#define XCVR_IARU_REGION 1
+#endif
+
+#define BAND_COUNT 9 // 160, 80, 40, 30, 20, 17, 15, 12, 10
+#define NO_BAND 0xFF
+
+#ifndef BAND_TRACKING_HYSTERESIS
+#define BAND_TRACKING_HYSTERESIS 5000UL // in Hz, how far tuning may leave a band before it is switched
+#endif
+
 typedef struct Band {
 	unsigned short startFrequency; // in KHz
-	unsigned short bandLength; // in KHz
+	unsigned short endFrequency; // in KHz
 	byte meters;
-	bool isUpperSideband;
+	byte sideband; // the default one
+	byte filterIndex;
+	unsigned short expanderMask; // port expander pins to raise, GPA0 is bit 0
+};
+
+// Port expander pins driven as outputs, GPA0..GPB1. The band filters use GPA0..GPB0, the spare
+// GPB1 is held low. The other pins are inputs; their latches keep the power-on LOW, which is also
+// what Xcvr::switchBandFilters() writes to them.
+#define EXPANDER_OUTPUT_PINS 0x03FF
+
+extern const Band bandPlan[BAND_COUNT] PROGMEM;
+
+/**
+	Latency instrumentation.
+
+	Build with XCVR_PROFILING set to 1 to get probes around the hot paths. Each probe keeps
+	min/max/mean and a log2 histogram of its durations in a fixed amount of RAM. Send "PRF"
+	over serial to dump them and "PRR" to reset them. With XCVR_PROFILING set to 0 the probes
+	compile to nothing.
+ */
+#ifndef XCVR_PROFILING
+#define XCVR_PROFILING 0
+#endif
+
+enum ProfileProbe {
+	PROBE_LOOP = 0,			// time between two consecutive XcvrUi::update() calls
+	PROBE_KEYER_UPDATE,
+	PROBE_UI_UPDATE,
+	PROBE_RENDER,
+	PROBE_SYNTH_WRITE,		// a single si5351.set_freq()
+	PROBE_EXPANDER_WRITE,	// a complete band filter switch on the mcp
+	PROBE_DISPLAY_STALENESS,	// from a status change until the display and serial status show it
+	PROBE_KEY_SPACE_ERROR,	// how far an element space inside a character was off, in either direction
+	PROBE_KEY_TO_RF,		// from a key down until the key line is up, lead time included
+	PROBE_RF_TO_RECEIVE,	// from the end of the PTT tail until the receiver is tuned and the PTT is down
+	PROBE_TIMER_ISR,		// a single timerIsr()
+	PROBE_METER_ISR,		// a single audio meter sample, with XCVR_AUDIO_METER
+	PROBE_COUNT
+};
+
+#define PROFILE_BUCKETS 12 // bucket 0 is < 8us, bucket n is < 2^(n + 3)us, the last one catches the rest
+
+#if XCVR_PROFILING
+
+#ifdef ARDUINO
+inline unsigned long profilerNow() { return micros(); }
+#else
+#include <time.h>
+inline unsigned long profilerNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long) (now.tv_sec * 1000000UL + now.tv_nsec / 1000);
+}
+#endif
+
+class Profiler {
+public:
+	static void record(byte probe, unsigned long elapsed);
+	static void reset();
+	static void dump();
+	static inline unsigned int ramUsage() { return sizeof(stats); }
+
+	static volatile unsigned long interruptMicros; // spent in timerIsr() since the last reset
+
+private:
+	static unsigned long since;
+	struct Stats {
+		unsigned long min;
+		unsigned long max;
+		unsigned long sum;
+		unsigned int count;
+		unsigned int buckets[PROFILE_BUCKETS];
+	};
+	static Stats stats[PROBE_COUNT];
+};
+
+class ProfileScope {
+public:
+	ProfileScope(byte probe) : probe(probe), start(profilerNow()) {}
+	~ProfileScope() { Profiler::record(probe, profilerNow() - start); }
+private:
+	byte probe;
+	unsigned long start;
+};
+
+#define PROFILE_JOIN_(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_(a, b)
+#define PROFILE_SCOPE(probe) ProfileScope PROFILE_JOIN(profileScope, __LINE__)(probe)
+#define PROFILE_RECORD(probe, elapsed) Profiler::record(probe, elapsed)
+
+#else
+
+#define PROFILE_SCOPE(probe)
+#define PROFILE_RECORD(probe, elapsed)
+
+#endif
+
+/**
+	Input/output tracing.
+
+	With XCVR_TRACE set to TRACE_RECORD every encoder, encoder button, mode button and paddle
+	input and every key line, PTT, synth and display frame output is written to serial as a
+	binary record: TRACE_SYNC, type, value, the time since the previous record in ms (16 bits,
+	little endian) and, for TRACE_SYNTH the frequency in Hz and for TRACE_ENCODER_DELTA the
+	whole signed delta, a 32 bit little endian payload.
+	The text status lines stay readable in between the records.
+
+	With XCVR_TRACE set to TRACE_REPLAY the serial input is reserved for a recorded trace: its
+	input records are fed to the keyer and the UI in place of the pins and the encoder, with
+	their original timing, while the outputs are still recorded. Playing the same trace against
+	two firmware versions and diffing the captured outputs shows what changed.
+ */
+#define TRACE_OFF 0
+#define TRACE_RECORD 1
+#define TRACE_REPLAY 2
+
+#ifndef XCVR_TRACE
+#define XCVR_TRACE TRACE_OFF
+#endif
+
+#define TRACE_SYNC 0x1E
+
+enum TraceEventType {
+	TRACE_ENCODER_DELTA = 0x01,	// value is unused, the delta is the payload
+	TRACE_ENCODER_BUTTON,	// value is the debounced pin level
+	TRACE_MODE_BUTTON,		// value is the debounced pin level
+	TRACE_PADDLE_DIT,		// value is the pin level
+	TRACE_PADDLE_DAH,
+	TRACE_KEY_LINE = 0x10,
+	TRACE_PTT,
+	TRACE_SYNTH,			// value is the si5351 clock
+	TRACE_FRAME
+};
+
+#if XCVR_TRACE != TRACE_OFF
+
+class Trace {
+public:
+	static void record(byte type, byte value);
+	static void record(byte type, byte value, unsigned long payload);
+	static void recordInput(byte type, short value);
+	static inline bool hasPayload(byte type) { return type == TRACE_SYNTH || type == TRACE_ENCODER_DELTA; }
+
+#if XCVR_TRACE == TRACE_REPLAY
+	static void service();
+	static byte paddleLevel(byte pin);
+	static short takeEncoderDelta();
+	static bool takeEncoderButtonEdge(byte& level);
+	static bool takeModeButtonEdge(byte& level);
+
+private:
+	static void apply();
+
+	static byte received[8];
+	static byte receivedLength;
+	static bool pending;
+	static unsigned long nextEventTime;
+	static byte ditLevel, dahLevel, modeLevel;
+	static bool modeEdge;
+	static short encoderDelta;
+	static byte encoderButtonLevel;
+	static bool encoderButtonEdge;
+#endif
+
+private:
+	static void writeHeader(byte type, byte value);
+	static unsigned long lastRecordTime;
+};
+
+#define TRACE_OUTPUT(type, value) Trace::record(type, value)
+#define TRACE_OUTPUT_PAYLOAD(type, value, payload) Trace::record(type, value, payload)
+
+#else
+
+#define TRACE_OUTPUT(type, value)
+#define TRACE_OUTPUT_PAYLOAD(type, value, payload)
+
+#endif
+
+#if XCVR_TRACE == TRACE_RECORD
+#define TRACE_INPUT(type, value) Trace::recordInput(type, value)
+#else
+#define TRACE_INPUT(type, value)
+#endif
+
+/**
+	Input event queue.
+
+	The 1 ms Timer1 interrupt services the encoder, debounces the encoder and mode buttons and
+	pushes what happened as compact events into a single producer, single consumer ring which
+	XcvrUi::update() drains in order. Events use the trace input record types: encoder deltas
+	are the detent quarters counted since the previous event, button events the new pin level.
+
+	When the ring is full the interrupt holds the event back and retries on the next tick:
+	encoder movement keeps accumulating in ClickEncoder, a button edge stays pending. Every such
+	deferral is counted in overflows, button presses that came and went while pending in dropped. Send
+	"EVQ" over serial to print the counters and the ring's high water mark, "EVR" to reset them.
+ */
+#ifndef INPUT_QUEUE_SIZE
+#define INPUT_QUEUE_SIZE 16 // a power of 2
+#endif
+
+#define INPUT_DEBOUNCE_MILLISECONDS 5
+
+struct InputEvent {
+	byte type;		// TRACE_ENCODER_DELTA, TRACE_ENCODER_BUTTON or TRACE_MODE_BUTTON
+	short value;	// a fast spin can exceed a byte's worth of detent quarters
+};
+
+class InputQueue {
+public:
+	static bool push(byte type, short value); // interrupt side
+	static bool pop(InputEvent& event); // loop side
+	static inline bool full() { return ((head + 1) & (INPUT_QUEUE_SIZE - 1)) == tail; }
+	static void dump();
+	static void reset();
+
+	static volatile unsigned short overflows;
+	static volatile unsigned short dropped;
+	static volatile byte highWater;
+
+private:
+	static volatile InputEvent events[INPUT_QUEUE_SIZE];
+	static volatile byte head, tail;
+};
+
+/**
+	Debounces a button sampled from the timer interrupt: the level is accepted once it has been
+	read INPUT_DEBOUNCE_MILLISECONDS times in a row.
+ */
+class ButtonSampler {
+public:
+	ButtonSampler(byte pin, byte eventType)
+		: input(portInputRegister(digitalPinToPort(pin))), mask(digitalPinToBitMask(pin)), eventType(eventType) {}
+	void sample();
+	bool inline released() { return stableLevel == HIGH && lastRead == HIGH; }
+
+private:
+	volatile byte* input;	// read directly, digitalRead() is several times slower
+	byte mask;
+	byte eventType;
+	byte stableLevel = HIGH;	// debounced level
+	byte queuedLevel = HIGH;	// level last pushed to the input queue
+	byte lastRead = HIGH;
+	byte count = 0;
+};
+
+class Keyer;
+
+/**
+	Keyer timing benchmark.
+
+	Build with XCVR_KEYER_BENCHMARK set to 1 and send "KBM" (or "KBM <wpm>" for a single speed)
+	over serial. The keyer is then driven by scripted paddle patterns in every keyer mode, over a
+	range of speeds and weighting/dah to dit ratio/keying compensation settings. Every run prints
+	one CSV line with the element length error and jitter against ideal timing, the latency of
+	manually keyed edges and the PTT lead and tail times, all in microseconds.
+
+	The keyer runs its transmit path, PTT lead and tail included, but while the benchmark is
+	active the PTT and key lines and the synth are left alone: nothing is transmitted and a TX
+	inhibit set by the operator still holds afterwards. Only the sidetone can be heard.
+ */
+#ifndef XCVR_KEYER_BENCHMARK
+#define XCVR_KEYER_BENCHMARK 0
+#endif
+
+#if XCVR_KEYER_BENCHMARK
+
+class KeyerBenchmark {
+public:
+	static void run(Keyer& keyer, byte onlyWpm);
+	static void keyEdge(byte state, byte sending);
+	static void pttEdge(byte state);
+	static byte paddleLevel(byte pin);
+
+	static bool active;
+
+private:
+	struct ErrorStats {
+		unsigned int count;
+		long sum;
+		long min;
+		long max;
+		void add(long error);
+		void write();
+	};
+
+	static void runOnce(Keyer& keyer, byte mode, byte wpm, byte setting, byte pattern);
+	static byte currentSegment(unsigned long now);
+
+	static ErrorStats dits, dahs, gaps, latencies;
+	static unsigned long unit;			// one dit at the current speed, in us
+	static unsigned long scriptStart;
+	static byte pattern;
+	static long ditOn, dahOn, ditOff, dahOff, expectedGap;
+	static unsigned long keyDownTime, keyUpTime, pttUpTime, pttLead, pttTail;
+	static byte keyDownSending;
+};
+
+#define KEYER_BENCHMARK_KEY(state, sending) if (KeyerBenchmark::active) KeyerBenchmark::keyEdge(state, sending)
+#define KEYER_BENCHMARK_PTT(state) if (KeyerBenchmark::active) KeyerBenchmark::pttEdge(state)
+#define KEYER_OUTPUTS_LIVE (!KeyerBenchmark::active)
+
+#else
+
+#define KEYER_BENCHMARK_KEY(state, sending)
+#define KEYER_BENCHMARK_PTT(state)
+#define KEYER_OUTPUTS_LIVE true
+
+#endif
+
+/**
+	Display backend.
+
+	By default the display is driven by u8glib's software SPI. Set XCVR_DISPLAY_HW_SPI to 1 to use
+	the hardware SPI peripheral instead: page data is queued and clocked out from the SPI interrupt
+	while u8glib composes the next page. This needs the display wired as listed above.
+ */
+#ifndef XCVR_DISPLAY_HW_SPI
+#define XCVR_DISPLAY_HW_SPI 0
+#endif
+
+#define DISPLAY_DC_PIN 9
+#define DISPLAY_RESET_PIN 10
+// Bytes waiting for the SPI interrupt, a power of two. The ring holds one byte less than its size
+// and the first byte of a page goes straight to SPDR, so 128 takes a whole page without waiting.
+#define DISPLAY_QUEUE_SIZE 128
+
+/**
+	Frame monitor.
+
+	Build with XCVR_FRAME_MONITOR set to 1 to put a counting shim in front of the display's com
+	function, whichever backend it is. For every full frame it counts the bytes sent and the
+	draw() calls, and keeps a checksum of each page to compare with the previous frame. That shows
+	how many pages really changed and how many bytes went into resending unchanged ones. Blits
+	are counted apart. Send "FRS" for the numbers. Send "FRM" to draw the current frame once more
+	and get its pages in hex; tools/frame2pbm.py turns that into a PBM image and compares it with
+	a known good one.
+ */
+#ifndef XCVR_FRAME_MONITOR
+#define XCVR_FRAME_MONITOR 0
+#endif
+
+#define FRAME_PAGES 8
+#define FRAME_PAGE_BYTES 128
+
+#if XCVR_FRAME_MONITOR
+
+class FrameMonitor {
+public:
+	static void install(u8g_t* u8g);
+	static void begin(bool dumping);
+	static void end();
+	static inline void drawn() { draws++; }
+	static void dump();
+
+private:
+	static uint8_t com(u8g_t* u8g, uint8_t msg, uint8_t arg_val, void* arg_ptr);
+	static void data(byte value);
+
+	static u8g_com_fnptr forward;
+	static bool inFrame;
+	static bool dumping;
+	static bool dataMode;
+	static unsigned short sums[FRAME_PAGES];		// of the frame being sent
+	static unsigned short lastSums[FRAME_PAGES];	// of the one before
+	static unsigned int dataBytes;					// of the frame being sent
+	static unsigned int frameBytes;					// data and commands, of the frame being sent
+	static byte draws;
+
+	// the last frame, then totals since boot
+	static unsigned int lastBytes;
+	static byte lastDraws;
+	static byte lastChangedPages;
+	static unsigned long frames;
+	static unsigned long totalBytes;
+	static unsigned long unchangedBytes;
+	static unsigned long blitBytes;
+};
+
+#define FRAME_BEGIN(dumping) FrameMonitor::begin(dumping)
+#define FRAME_DRAWN() FrameMonitor::drawn()
+#define FRAME_END() FrameMonitor::end()
+
+#else
+
+#define FRAME_BEGIN(dumping)
+#define FRAME_DRAWN()
+#define FRAME_END()
+
+#endif
+
+/**
+	Redrawing the display and writing the status to serial take long enough to stretch an element
+	space, so they wait for Keyer::idle_window(): key up, no element buffered, no paddle closed and
+	either PTT down or at least a letter space since the last element. Should the keyer never go
+	idle, the pending update is done anyway once it is DISPLAY_MAX_STALENESS_MILLISECONDS old.
+ */
+#ifndef DISPLAY_MAX_STALENESS_MILLISECONDS
+#define DISPLAY_MAX_STALENESS_MILLISECONDS 1000
+#endif
+
+/**
+	Radio state snapshot.
+
+	Xcvr, Keyer and XcvrUi publish what they own into radioState instead of raising flags, and
+	the consumers (display, serial status) copy a consistent snapshot whenever the sequence moved
+	past the one they last looked at. Every field group remembers the sequence it last changed at,
+	so changedSince() tells a consumer exactly which groups it has not seen yet, and a change
+	published while a consumer is busy is picked up on its next look instead of being lost.
+
+	Producers edit() a copy of the latest state and publish() it with the mask of the groups they
+	changed. The two buffers are swapped on publish and readers retry if a publish happened while
+	they were copying, so reading is safe against a publishing interrupt. Publishing from more than
+	one context at a time is not: an interrupt that publishes has to be the only one that does.
+ */
+enum StateField {
+	STATE_FREQUENCY = 0,
+	STATE_RIT,				// ritOn and ritAmount
+	STATE_SIDEBAND,
+	STATE_BAND,
+	STATE_CW_PITCH,
+	STATE_WPM,
+	STATE_KEYER_MODE,
+	STATE_UI,				// uiMode and stepIndex
+	STATE_FIELD_COUNT
+};
+
+#define STATE_BIT(field) (1 << (field))
+
+struct RadioState {
+	long frequency;			// in Hz, as displayed
+	short ritAmount;		// in Hz
+	bool ritOn;
+	byte sideband;
+	byte band;
+	word cwPitch;
+	byte wpm;
+	byte effectiveWpm;		// the Farnsworth speed, or wpm
+	byte keyerMode;
+	byte uiMode;
+	byte stepIndex;
+	byte scanState;
+	char scanDirection;
+	byte scanSource;
+	byte memory;			// the channel last recalled or stored, or NO_MEMORY
+};
+
+class RadioStateStore {
+public:
+	RadioState& edit();
+	void publish(unsigned short fields);
+	unsigned short read(RadioState& state); // returns the sequence of the copied state
+	unsigned short changedSince(unsigned short sequence); // STATE_BITs published after sequence
+	unsigned short inline sequence() { return published; }
+
+private:
+	RadioState buffers[2];
+	volatile byte front = 0;
+	volatile unsigned short published = 0;
+	unsigned short fieldSequences[STATE_FIELD_COUNT];
 };
 
+extern RadioStateStore radioState;
+
+/**
+	Tuning indicator and S-meter.
+
+	Build with XCVR_AUDIO_METER set to 1 and feed the receiver audio, biased to half the supply,
+	to A3. The ADC then converts A3 continuously and its interrupt runs three fixed point Goertzel
+	filters over the samples: one at the CW pitch and one METER_OFFSET_HZ below and above it.
+	Every METER_BLOCK_SIZE samples their state is handed to the loop, which turns it into powers
+	for the tuning bar (where the signal sits around the pitch) and the S-meter (how strong it is)
+	at the bottom right of the display.
+
+	The interrupt costs a 16x16 bit hardware multiply, a shift done by picking bytes and a few
+	additions per filter (see xcvr_goertzel.h). Counted from the instructions that is some 250
+	cycles, 16 us every 104 us, with the register saves; with XCVR_PROFILING the METER probe
+	measures it. It only ever delays the keyer's micros() based timing by that much. The powers,
+	the meter and the display are done by the loop, outside of keying.
+ */
+#ifndef XCVR_AUDIO_METER
+#define XCVR_AUDIO_METER 0
+#endif
+
+#define METER_SAMPLE_RATE 9615 // 16 MHz / 128 prescaler / 13 cycles per conversion
+#define METER_BLOCK_SIZE 64
+#define METER_OFFSET_HZ 150
+#define METER_REFRESH_MILLISECONDS 100
+#define METER_X 88 // up to the right edge of the bottom line
+#define METER_WIDTH 40
+#define METER_PAGE 7
+
+enum MeterFilter {
+	METER_BELOW = 0,
+	METER_AT_PITCH,
+	METER_ABOVE,
+	METER_FILTERS
+};
+
+class AudioMeter {
+public:
+	static void init(word pitch);
+	static void setPitch(word pitch);
+	static void sample(short value); // one ADC reading, from the interrupt
+	static bool read(long power[METER_FILTERS]); // false until another block is done
+
+private:
+	static volatile short coefficients[METER_FILTERS];
+	static short s1[METER_FILTERS], s2[METER_FILTERS];
+	static volatile short blockS1[METER_FILTERS], blockS2[METER_FILTERS];
+	static volatile bool blockReady;
+	static byte count;
+};
+
+/**
+	RAM report.
+
+	Build with XCVR_RAM_REPORT set to 1 and send "RAM" over serial. The first line has the .data,
+	.bss and heap sizes, the deepest the stack has reached since boot and the least free RAM there
+	ever was, found by painting the free RAM with STACK_PAINT at boot and looking for the first
+	byte that got overwritten. The second line breaks the static RAM down by subsystem.
+	tools/ram_report.py gives the same breakdown, symbol by symbol, from the built .elf.
+ */
+#ifndef XCVR_RAM_REPORT
+#define XCVR_RAM_REPORT 0
+#endif
+
+#define STACK_PAINT 0xC5
+
+/**
+	Idle sleep.
+
+	With XCVR_IDLE_SLEEP set to 1, once the display has gone to sleep and the keyer is idle, the
+	loop puts the MCU into idle sleep until the next interrupt: the millis() and Timer1 ticks, a
+	byte on the UART, or a pin change on the paddles, the encoder or its button, or the mode
+	button. While sleeping the encoder is serviced at ENCODER_RATE_IDLE. Builds with
+	XCVR_AUDIO_METER wake up for every ADC sample too.
+ */
+#ifndef XCVR_IDLE_SLEEP
+#define XCVR_IDLE_SLEEP 1
+#endif
+
+/**
+	Encoder service rate.
+
+	Timer1 services the encoder and samples the buttons every millisecond only while they are in
+	use. With XCVR_ADAPTIVE_ENCODER set to 1 it slows down to ENCODER_RESTING_PERIOD_MICROSECONDS
+	after ENCODER_QUIET_TICKS ticks without a turn or a button down, and to
+	ENCODER_IDLE_PERIOD_MICROSECONDS while the MCU sleeps. A pin change on the encoder or the
+	buttons puts it back to full rate before the input is even sampled, so nothing is lost. The
+	paddles leave the rate alone: they only wake the MCU, and the keyer keeps the cycles.
+	Profiling builds time the interrupt (the TIMER probe) and report its share of the CPU.
+ */
+#ifndef XCVR_ADAPTIVE_ENCODER
+#define XCVR_ADAPTIVE_ENCODER 1
+#endif
+
+#define ENCODER_ACTIVE_PERIOD_MICROSECONDS 1000
+#define ENCODER_RESTING_PERIOD_MICROSECONDS 4000
+#define ENCODER_IDLE_PERIOD_MICROSECONDS 8000
+#define ENCODER_QUIET_TICKS 250
+
+enum EncoderRate {
+	ENCODER_RATE_ACTIVE = 0,
+	ENCODER_RATE_RESTING,
+	ENCODER_RATE_IDLE
+};
+
+/**
+	Memory channels.
+
+	MEMORY_CHANNELS fixed size records from the start of the EEPROM, each the frequency, sideband,
+	filter and RIT flag packed in 32 bits, then the RIT amount and a short label. After them comes
+	a header with a magic word and one occupancy bit per channel, which is all that is read at boot:
+	finding the next stored channel, for the encoder or a scan, walks the bits in RAM a byte at a
+	time and only a recall reads its record. The EEPROM from MEMORY_EEPROM_END on is left for
+	others.
+
+	Serial commands: "MR nn" recalls, "MW nn LBL" stores the current frequency, "ME nn" erases,
+	"ML" lists the stored channels.
+ */
+#define MEMORY_CHANNELS 100
+#define MEMORY_LABEL_LENGTH 3
+#define MEMORY_RECORD_SIZE 9 // packed frequency and flags, RIT amount, label
+#define MEMORY_EEPROM_HEADER (MEMORY_CHANNELS * MEMORY_RECORD_SIZE)
+#define MEMORY_EEPROM_END (MEMORY_EEPROM_HEADER + 2 + (MEMORY_CHANNELS + 7) / 8)
+#define MEMORY_MAGIC 0x4D43
+#define NO_MEMORY 0xFF
+
+// the packed word of a record
+#define MEMORY_FREQUENCY_MASK 0x01FFFFFFUL // 25 bits of Hz, up to 33.5 MHz
+#define MEMORY_SIDEBAND_BIT 25
+#define MEMORY_FILTER_SHIFT 26 // 2 bits
+#define MEMORY_RIT_ON_BIT 28
+
+struct MemoryChannel {
+	freq_t frequency;		// in Hz
+	short ritAmount;		// in Hz
+	bool ritOn;
+	byte sideband;
+	byte filterIndex;
+	char label[MEMORY_LABEL_LENGTH + 1];
+};
+
+class MemoryStore {
+public:
+	static void init();
+	static bool read(byte channel, MemoryChannel& memory); // false if the channel is empty
+	static void write(byte channel, const MemoryChannel& memory);
+	static void erase(byte channel);
+	static bool inline occupied(byte channel) { return occupancy[channel >> 3] & (1 << (channel & 7)); }
+	static byte next(byte from, char direction); // the next stored channel around from, or NO_MEMORY
+	static byte firstFree(); // or NO_MEMORY
+	static unsigned int inline ramUsage() { return sizeof(occupancy); }
+
+private:
+	static void writeOccupancy(byte channel);
+
+	static byte occupancy[(MEMORY_CHANNELS + 7) / 8];
+};
+
+/**
+	Operating statistics.
+
+	With XCVR_STATS set to 1, running counters of what the radio did are kept in RAM and saved to
+	the EEPROM from STATS_EEPROM_BASE on every STATS_SAVE_INTERVAL_MILLISECONDS, from an idle
+	window and only the bytes that changed. They survive power cycles, up to the last save.
+	Counting is a single increment in the paths that do the work, with XCVR_STATS set to 0 it
+	compiles to nothing.
+
+	Send "STA" over serial to dump them on one line and "STC" to clear them.
+ */
+#ifndef XCVR_STATS
+#define XCVR_STATS 1
+#endif
+
+#define STATS_EEPROM_BASE 960
+#define STATS_MAGIC 0x5354
+#define STATS_SAVE_INTERVAL_MILLISECONDS (15 * 60 * 1000UL)
+#define LOOP_OVERRUN_MILLISECONDS 20
+
+#if MEMORY_EEPROM_END > STATS_EEPROM_BASE
+#error "the memory channels run into the statistics in the EEPROM"
+#endif
+
+enum StatCounter {
+	STAT_TX_MILLISECONDS = 0,	// with the PTT up
+	STAT_KEY_DOWNS,				// on the air, not the sidetone-only ones
+	STAT_PTT_CYCLES,
+	STAT_CHARACTERS,			// one per keyer mode, STRAIGHT to TUNING, in that order
+	STAT_BAND_CHANGES = STAT_CHARACTERS + 6,	// not the one at boot
+	STAT_TUNING_STEPS,
+	STAT_SYNTH_WRITES,
+	STAT_EXPANDER_WRITES,		// every one switches the band relays
+	STAT_LOOP_OVERRUNS,			// loops over LOOP_OVERRUN_MILLISECONDS long that started with the keyer
+								// idle and did not draw, save the statistics or send an element
+	STAT_COUNT
+};
+
+#if XCVR_STATS
+
+class OperatingStats {
+public:
+	static void init();
+	static void save();
+	static void clear();
+	static void dump();
+	static inline void count(byte counter) { counters[counter]++; }
+	static inline void add(byte counter, unsigned long amount) { counters[counter] += amount; }
+	static inline unsigned int ramUsage() { return sizeof(counters); }
+
+private:
+	static unsigned long counters[STAT_COUNT];
+};
+
+#define STATS_COUNT(counter) OperatingStats::count(counter)
+#define STATS_ADD(counter, amount) OperatingStats::add(counter, amount)
+
+#else
+
+#define STATS_COUNT(counter)
+#define STATS_ADD(counter, amount)
+
+#endif
+
+/**
+	Bus accounting.
+
+	Build with XCVR_BUS_ACCOUNTING set to 1 to account for the I2C traffic of every high level
+	Xcvr operation: key, unkey, a tuning step, RIT, a band change, the sideband, the CW pitch and
+	a memory recall. Per operation it counts how often it ran, the synth and port expander writes
+	it did and the time they took. The bytes it shows are an estimate, the writes times a typical
+	size per write: the libraries talk to Wire directly and their traffic is not counted.
+
+	Each write Xcvr asks for is also kept, the last frequency per synth clock and the last
+	expander pins, and compared with what Xcvr holds once the outermost operation is done: the
+	clocks have to be on the transmit or receive frequencies of the mode it is in and the pins on
+	the band's mask. That catches a write Xcvr missed or left stale. It knows nothing of the
+	devices' registers, so it cannot catch an error in the libraries or on the bus.
+
+	Send "BUS" over serial for the table, the last writes and the failed checks, "BUR" to reset
+	them.
+ */
+#ifndef XCVR_BUS_ACCOUNTING
+#define XCVR_BUS_ACCOUNTING 0
+#endif
+
+// estimated bytes on the bus per write, address bytes included, from reading the libraries
+#define BUS_SYNTH_WRITE_BYTES 20 // the 8 multisynth registers, plus the R divider read-modify-write
+#define BUS_EXPANDER_WRITE_BYTES 4 // address, GPIOA register, both ports
+#define BUS_PINS_UNKNOWN 0xFFFF // before the first expander write
+
+enum BusOperation {
+	BUS_KEY = 0,
+	BUS_UNKEY,
+	BUS_TUNE,
+	BUS_RIT,
+	BUS_BAND,
+	BUS_SIDEBAND,
+	BUS_PITCH,
+	BUS_RECALL,
+	BUS_OTHER,		// writes outside of any of the above, init for one
+	BUS_OPERATION_COUNT
+};
+
+#if XCVR_BUS_ACCOUNTING
+
+class BusMonitor {
+public:
+	static void begin(byte operation);
+	static void end(byte operation);
+	static void synthWrite(byte clock, freq_t frequency, unsigned long elapsed);
+	static void expanderWrite(unsigned short pins, unsigned long elapsed);
+	static void dump();
+	static void reset();
+
+private:
+	static void check(byte operation);
+
+	struct Account {
+		unsigned int count;
+		unsigned int synthWrites;
+		unsigned int expanderWrites;
+		unsigned long estimatedBytes;
+		unsigned long micros;
+	};
+	static Account accounts[BUS_OPERATION_COUNT];
+	static byte current;			// the outermost operation running, or BUS_OPERATION_COUNT
+	static freq_t clocks[3];		// the last writes, 0 until written
+	static unsigned short pins;
+	static unsigned int failedChecks;
+	static byte lastFailed;
+};
+
+class BusOperationScope {
+public:
+	BusOperationScope(byte operation) : operation(operation) { BusMonitor::begin(operation); }
+	~BusOperationScope() { BusMonitor::end(operation); }
+private:
+	byte operation;
+};
+
+#define BUS_OPERATION(operation) BusOperationScope busOperationScope(operation)
+
+#else
+
+#define BUS_OPERATION(operation)
+
+#endif
+
 // TODO Adrian: extract ui and keyer to their own libs
 class Xcvr; // forward
 class Keyer;
@@ -90,9 +908,87 @@ enum UiMode {
 	SETTING_KEYER_MODE,
 	SETTING_BAND,
 	SETTING_CW_PITCH,
+	SETTING_MEMORY,
+	SCANNING,
 	LAST_MODE 
 };
 
+/**
+	Scanning.
+
+	In the SCANNING mode a turn of the encoder starts a scan in that direction and a click of it
+	switches between scanning the band and the memory channels. A band scan moves by the tuning
+	step every SCAN_DWELL_MILLISECONDS, from one edge of the band to the other and around again;
+	a memory scan recalls the stored channels one after the other. With XCVR_AUDIO_METER the scan holds while there is a signal at the
+	pitch and goes on SCAN_DWELL_MILLISECONDS after it is gone. Any paddle, encoder or button
+	input stops it, except for the rest of the turn that started it: encoder deltas are ignored
+	until the encoder has been quiet for SCAN_START_GUARD_MILLISECONDS. Steps are only taken in
+	the keyer's idle windows.
+ */
+#ifndef SCAN_DWELL_MILLISECONDS
+#define SCAN_DWELL_MILLISECONDS 100
+#endif
+
+#ifndef SCAN_START_GUARD_MILLISECONDS
+#define SCAN_START_GUARD_MILLISECONDS 300
+#endif
+
+enum ScanState {
+	SCAN_STOPPED = 0,
+	SCAN_RUNNING,
+	SCAN_HOLDING		// on a signal
+};
+
+enum ScanSource {
+	SCAN_BAND = 0,
+	SCAN_MEMORIES
+};
+
+enum Gesture {
+	GESTURE_NONE = 0,
+	GESTURE_CLICK,
+	GESTURE_DOUBLE_CLICK,
+	GESTURE_HOLD,
+	GESTURE_LONG_HOLD,
+	GESTURE_HOLD_TURN		// the encoder was turned while the button was down
+};
+
+#define GESTURE_DOUBLE_CLICK_MILLISECONDS 300
+#define GESTURE_HOLD_MILLISECONDS 600
+#define GESTURE_LONG_HOLD_MILLISECONDS 2000
+
+/**
+	Turns the debounced press and release edges of a button, plus encoder turns while it is down,
+	into gestures without ever blocking. Feed it with press()/release()/turn() and collect at most
+	one gesture per poll(). A hold is reported on release, only if the button was neither held
+	long enough for a long hold nor turned, so that a long hold does not start with a hold.
+ */
+class GestureRecognizer {
+public:
+	void press(unsigned long now);
+	void release(unsigned long now);
+	bool turn(short amount); // true if the turn belongs to a hold+turn
+	byte poll(unsigned long now);
+	short inline turnAmount() { return lastTurned; } // detents of the last GESTURE_HOLD_TURN
+
+private:
+	enum {
+		GESTURE_STATE_IDLE = 0,
+		GESTURE_STATE_DOWN,
+		GESTURE_STATE_WAITING,	// released once, a second click would make it a double click
+		GESTURE_STATE_HELD,
+		GESTURE_STATE_LONG_HELD,
+		GESTURE_STATE_TURNED
+	};
+
+	byte state = GESTURE_STATE_IDLE;
+	byte clicks = 0;
+	byte pending = GESTURE_NONE;
+	short turned = 0;
+	short lastTurned = 0;
+	unsigned long since = 0;
+};
+
 class XcvrUi {
 public:
 	XcvrUi();
@@ -100,23 +996,134 @@ public:
 	void render();
 	void update();
 
-	static ClickEncoder *encoder;
+	static ClickEncoder encoder;
 
  private:
 	void draw();
 	void renderFrequency();
 	void renderRit();
+	void renderBand();
+	void renderWpm();
+	void renderPitch();
+	void renderMemory();
+	void rememberDrawn();
+	bool blitChanges(unsigned short changed);
+	void blitGlyph(const byte* glyph, byte x, byte firstPage, byte pages, byte width, const byte* invertMasks);
+	void blitColumns(const byte* columns, byte x, byte page, byte width);
+#if XCVR_AUDIO_METER
+	void updateMeter(unsigned long now);
+	void blitMeter();
+#endif
 	void advertiseStatus();
+	void refresh(unsigned long now);
+#if XCVR_IDLE_SLEEP
+	void idleSleep();
+#endif
+	void publishState();
+	void handleInput(const InputEvent& event, unsigned long now);
+	void handleTurn(int amount);
+	void handleModeButton(byte gesture, short turned);
+	void handleEncoderButton(byte gesture, short turned);
+	void changeStepSize(short amount);
+	void setMode(byte newMode);
+	byte stepDigitPosition();
+	void recallMemory(byte channel);
+	void storeMemory(byte channel, const char* label);
+	void listMemories();
+	void startScan(char direction);
+	void stopScan();
+	void serviceScan(unsigned long now);
+	long nextScanFrequency();
+	void serviceSerial();
+	void handleCommand(const char* command);
+	void handleQskCommand(const char* arguments);
+#if XCVR_FRAME_MONITOR
+	void dumpFrame();
+#endif
+#if XCVR_RAM_REPORT
+	void reportRam();
+#endif
 
 	byte mode = NORMAL;
-	short int lastEncoderValue, currentEncoderValue;
-	short int stepSize = 10;
+	char commandBuffer[16];
+
+	// the state on display and its sequence in radioState
+	RadioState shown;
+	unsigned short shownSequence = 0;
+
+	// the text on display since the last render, so digit changes can be blitted
+	struct {
+		char frequency[10];
+		char wpm[2];
+		char pitch[4];
+		bool valid;
+	} drawn;
+	byte commandLength = 0;
+	short int currentEncoderValue;
+	long stepSize = 10;
+	byte stepIndex = 0;
+	bool changePending = false;
+	unsigned long changePendingSince = 0;
+	byte memory = NO_MEMORY;
+	char memoryLabel[MEMORY_LABEL_LENGTH + 1];
+	struct {
+		byte state;
+		byte source;
+		char direction;
+		unsigned long stepTime;
+		unsigned long lastTurn;	// the last encoder delta of the turn that started it
+	} scan;
+#if XCVR_AUDIO_METER
+	struct {
+		long level;			// smoothed power at the pitch
+		char tuning;		// -METER_WIDTH / 2 .. METER_WIDTH / 2, how far off the pitch the signal is
+		byte bar;			// 0 .. METER_WIDTH
+		bool signal;
+		bool blockSignal;	// in the latest block alone, without the decay
+		byte blocks;		// done since the last scan step, up to 255
+		bool drawnValid;
+		char drawnTuning;
+		byte drawnBar;
+		bool drawnSignal;
+		unsigned long lastDrawn;
+	} meter;
+#endif
+	GestureRecognizer modeButton;
+	GestureRecognizer encoderButton;
+
+	#define STEP_UNDERLINE_ROW 14
 
 	Xcvr* xcvr;
 	Keyer* keyer;
-	U8GLIB_SSD1306_128X64* display; 
+	U8GLIB* display;
+};
+
+/**
+	QSK sequencing.
+
+	Every transmit/receive transition is a short table of actions, run in table order. Actions
+	marked QSK_AFTER_LEAD wait until ptt_lead_time has passed since the transition started, so
+	coming from receive the PTT goes up and the transmit frequencies are written to the synth
+	first, and the key line and sidetone only follow once the lead time is over. Going back, the
+	receive frequencies are written while the PTT is still up, then it drops: the receiver comes
+	back tuned. The PTT tail itself is timed by Keyer::check_ptt_tail() and never blocks.
+
+	Send "QSK" over serial for the lead and tail times and the last key to RF and RF to receive
+	times, "QSK <lead> <tail>" to change the first two, in milliseconds.
+ */
+enum QskAction {
+	QSK_PTT_ON = 0,
+	QSK_SYNTH_TRANSMIT,
+	QSK_KEY_ON,
+	QSK_FIRST_EXTENSION,	// first_extension_time, only coming from receive
+	QSK_SIDETONE_ON,
+	QSK_KEY_OFF,
+	QSK_SIDETONE_OFF,
+	QSK_SYNTH_RECEIVE,
+	QSK_PTT_OFF
 };
 
+#define QSK_AFTER_LEAD 0x80 // or'ed to an action
 
 class Keyer {
 public:
@@ -130,18 +1137,24 @@ public:
 	void check_paddles();
 	void check_dit_paddle();
 	void check_dah_paddle();
-	void ptt_key();
 	void ptt_unkey();
+	void qsk_run(const byte* actions, byte count);
+	void qsk_action(byte action);
 	void check_ptt_tail();
 	void send_dit(byte sending_type);
 	void send_dah(byte sending_type);
 	void tx_and_sidetone_key(int state, byte sending_type);
-	void loop_element_lengths(float lengths, float additional_time_ms, int speed_wpm_in, byte sending_type);
+	void loop_element_micros(unsigned long duration);
+	void compute_timing();
+	void next_keyer_mode();
 	void speed_set(int wpm_set);
+	void farnsworth_set(byte wpm_set);
 	void speed_change(int change);
 	void sidetone_adj(int hz);
 	void service_dit_dah_buffers();
 	int paddle_pin_read(int pin_to_read);
+	bool idle_window();
+	void publish_state(unsigned short fields);
 	void boop_beep();
 	void beep_boop();
 	void boop();
@@ -159,8 +1172,30 @@ public:
 		byte weighting;
 		byte dit_buffer_off;
 		byte dah_buffer_off;
+		byte farnsworth_wpm; // the effective speed, 0 or wpm and above for none
 	} configuration;
 
+	/**
+		Every duration the keyer waits for, worked out by compute_timing() whenever a setting they
+		depend on changes, so that sending an element is no more than waiting for one of them.
+
+		With a Farnsworth speed the characters are sent at wpm and the spaces between characters
+		and words are stretched (ARRL: a total of 60 * wpm - 37.2 * farnsworth_wpm over
+		farnsworth_wpm * wpm seconds per word, 3/19 of it per letter space and 7/19 per word
+		space) so that the text goes out at the lower speed. The keyer owns the letter space only
+		when it autospaces: with a Farnsworth speed set it always does.
+	 */
+	struct {
+		unsigned long dit_on;		// in us, weighting and keying compensation included
+		unsigned long dit_off;
+		unsigned long dah_on;
+		unsigned long dah_off;
+		unsigned long autospace;	// in us, added after the last element of a character
+		unsigned int letterspace;	// in ms
+		unsigned int ptt_hang;		// in ms, after manual sending
+		unsigned int character_gap;	// in ms, a key up longer than this starts another character
+	} timing;
+
 
 
 	/** pins **/
@@ -185,9 +1220,26 @@ public:
 	#define ULTIMATIC 5
 	#define TUNING 6
 
-	#define ULTIMATIC_NORMAL 0
-	#define ULTIMATIC_DIT_PRIORITY 1
-	#define ULTIMATIC_DAH_PRIORITY 2
+	/**
+		Keyer modes compiled in. Override KEYER_ENABLED_MODES with a mask of KEYER_MODE_BIT()s to
+		build a keyer that only supports those modes. The checks for the other modes fold to
+		constants and their code is dropped. With a single mode enabled, the mode dispatch goes
+		away completely.
+	 */
+	#define KEYER_MODE_BIT(mode) (1 << (mode))
+	#ifndef KEYER_ENABLED_MODES
+	#define KEYER_ENABLED_MODES (KEYER_MODE_BIT(STRAIGHT) | KEYER_MODE_BIT(IAMBIC_B) | KEYER_MODE_BIT(IAMBIC_A) | \
+								 KEYER_MODE_BIT(BUG) | KEYER_MODE_BIT(ULTIMATIC) | KEYER_MODE_BIT(TUNING))
+	#endif
+	#if KEYER_ENABLED_MODES == 0
+	#error "KEYER_ENABLED_MODES needs at least one keyer mode"
+	#endif
+	#define KEYER_MODE_ENABLED(mode) ((KEYER_ENABLED_MODES & KEYER_MODE_BIT(mode)) != 0)
+	#define KEYER_SINGLE_MODE ((KEYER_ENABLED_MODES & (KEYER_ENABLED_MODES - 1)) == 0)
+
+	bool inline is_keyer_mode(byte mode) {
+		return KEYER_MODE_ENABLED(mode) && (KEYER_SINGLE_MODE || configuration.keyer_mode == mode);
+	}
 
 	#define AUTOMATIC_SENDING 0
 	#define MANUAL_SENDING 1
@@ -206,6 +1258,8 @@ public:
 	#define default_keying_compensation 0    // number of milliseconds to extend all dits and dahs - for QSK on boatanchors
 	#define default_first_extension_time 0   // number of milliseconds to extend first sent dit or dah
 	#define default_ptt_hang_time_wordspace_units 1.0
+	#define default_ptt_lead_time 10         // milliseconds from PTT up to key line up, coming from receive
+	#define default_ptt_tail_time 10         // milliseconds from key line down to PTT down, automatic sending
 	#define wpm_limit_low 5
 	#define wpm_limit_high 60
 	#define hz_high_beep 1500                // frequency in hertz of high beep
@@ -213,23 +1267,37 @@ public:
 	#define initial_speed_wpm 24             // "factory default" keyer speed setting
 
 	byte command_mode_disable_tx = 0;
-	byte ptt_tail_time = 10;
-	byte ptt_lead_time = 10;
+	byte ptt_tail_time = default_ptt_tail_time;
+	byte ptt_lead_time = default_ptt_lead_time;
 	byte manual_ptt_invoke = 0;
 	byte key_tx = 0;         // 0 = tx_key_line control suppressed
 	byte dit_buffer = 0;     // used for buffering paddle hits in iambic operation
 	byte dah_buffer = 0;     // used for buffering paddle hits in iambic operation
 	byte being_sent = 0;     // SENDING_NOTHING, SENDING_DIT, SENDING_DAH
 	byte key_state = 0;      // 0 = key up, 1 = key down
-	byte config_dirty = 0;
 	unsigned long ptt_time = 0; 
+	unsigned long key_up_time = 0;
+#if XCVR_PROFILING
+	unsigned long key_up_micros = 0;
+	unsigned long expected_space_micros = 0;
+#endif
 	byte ptt_line_activated = 0;
+	unsigned long qsk_started = 0;			// micros() when the running transition started
+	unsigned long key_to_rf_micros = 0;		// of the last key down
+	unsigned long rf_to_receive_micros = 0;	// of the last return to receive
+#if XCVR_STATS
+	unsigned long ptt_up_time = 0;
+#endif
 	byte length_letterspace = default_length_letterspace;
 	byte keying_compensation = default_keying_compensation;
 	byte first_extension_time = default_first_extension_time;
 	byte ultimatic_mode = ULTIMATIC_NORMAL;
+	byte paddle_closure = NO_CLOSURE; // which paddles ULTIMATIC last saw closed
 	float ptt_hang_time_wordspace_units = default_ptt_hang_time_wordspace_units;
 	byte last_sending_type = MANUAL_SENDING;
+#if XCVR_TRACE == TRACE_RECORD
+	byte last_paddle_level[2] = {HIGH, HIGH};
+#endif
 	byte zero = 0;
 	byte iambic_flag = 0;
 	unsigned long last_config_write = 0;
@@ -244,10 +1312,7 @@ public:
 	void init();
 	void setFilter(unsigned char index);
 	void setSideband(Sideband sideband);
-	void incrementFrequency(int amount);
-
-	bool inline hasStatusChanged() { return statusChanged; }
-	void inline clearStatusChange() { statusChanged = false; }
+	void incrementFrequency(long amount);
 
 	void setCwPitch(unsigned short int pitch);
 
@@ -261,16 +1326,20 @@ public:
 	void ritIncrement(short amount);
 	short getRitAmount();
 
+	void recall(const MemoryChannel& memory);
+	void store(MemoryChannel& memory);
+
 	void key();
 	void unkey();
 
 	short ritAmount = 0; // delta, in Hz
-	long long frequency = 1000000LL; // in Hz, the frequency that is being displayed on screen
+	freq_t frequency = 1000000UL; // in Hz, the frequency that is being displayed on screen
 
 	Filter filters[1];
 	unsigned char filterIndex;
 
-	Band bands[10]; // 160, 80, 40, 30, 20, 15, 17, 12, 10, ext
+	static void getBandPlan(byte index, Band& band);
+
 	unsigned char bandIndex; // this one can be merged with filterIndex and status changedto save space
 
 	Sideband sideband; // 0 == upper, 1 == lower
@@ -279,21 +1348,29 @@ public:
 	unsigned char inTransmitMode;
 	unsigned char flags;
 
-	long long transmitVfoFrequency; // in hundreds of Hz, changed when switching encoder or rit
-	long long receiveVfoFrequency; // in hundreds of Hz, changed when switching encoder, rit, or enabling/disabling rit
-	long long receiveBfoFrequency; // in hundreds of Hz, changed when switching filters or sideband
-	long long transmitBfoFrequency; // in hundreds of Hz, changed when switching filters or sideband
-	bool statusChanged = false;
+	freq_t transmitVfoFrequency; // in Hz, changed when switching encoder or rit
+	freq_t receiveVfoFrequency; // in Hz, changed when switching encoder, rit, or enabling/disabling rit
+	freq_t receiveBfoFrequency; // in Hz, changed when switching filters or sideband
+	freq_t transmitBfoFrequency; // in Hz, changed when switching filters or sideband
 
 	Si5351 si5351;
 	Adafruit_MCP23017 mcp;
 
 private:
+	void publishState(unsigned short fields);
+	void writeSynth(freq_t frequency, enum si5351_clock clock);
 	void recalculateBfo();
 	void setVfoFrequency();
 	void setBfoFrequency();
 	void switchBandFilters();
 	void applyCurrentBandSettings();
+	void applyBand();
+	byte findBand(freq_t frequency);
+	bool trackBand();
+	freq_t vfoFrequencyFor(freq_t frequency);
+	void updateVfoFrequencies();
+
+	freq_t bandHoldLow, bandHoldHigh; // in Hz, the current band's edges widened by the hysteresis
 };
 
 
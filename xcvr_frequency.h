@@ -0,0 +1,58 @@
+#ifndef xcvr_frequency_h_
+#define xcvr_frequency_h_
+
+/**
+	Frequency arithmetic of Xcvr, for any frequency type F.
+
+	Xcvr uses these with its freq_t, 64 or 32 bit depending on XCVR_FREQUENCY_32BIT. They take
+	the frequency type as a template parameter and have no Arduino dependencies, so that
+	tools/frequency_test.cpp can run both widths side by side on the host and compare what would
+	be written to the Si5351.
+ */
+
+// Mixing with a VFO below the signal, above the IF, or above the signal, below the IF: the VFO
+// moves with the frequency in the first case and against it in the second.
+template <typename F>
+inline F mixVfoFrequency(F frequency, F intermediateFrequency) {
+	return frequency > intermediateFrequency ?
+				frequency - intermediateFrequency :
+				intermediateFrequency - frequency;
+}
+
+// the frequency the receiver listens on
+template <typename F>
+inline F ritFrequency(F frequency, bool ritOn, short ritAmount) {
+	return frequency + (ritOn ? ritAmount : 0);
+}
+
+// The receive BFO sits cwPitch off the filter center, moved further out when half the filter is
+// wider than that so that the other sideband stays out; the transmit BFO is cwPitch back in.
+template <typename F>
+inline void bfoFrequencies(F centerFrequency, short bandwidth, unsigned short cwPitch, bool upperSideband,
+						   F& receiveBfoFrequency, F& transmitBfoFrequency) {
+	if (upperSideband)
+		receiveBfoFrequency = centerFrequency + cwPitch;
+	else
+		receiveBfoFrequency = centerFrequency - cwPitch;
+
+	// correct BFO if needed so that we don't get both sidebands of the signal
+	if (bandwidth / 2 > cwPitch) {
+		short amountToCorrect = bandwidth / 2 - cwPitch;
+		if (upperSideband)
+			receiveBfoFrequency += amountToCorrect;
+		else
+			receiveBfoFrequency -= amountToCorrect;
+	}
+
+	transmitBfoFrequency = upperSideband ?
+								receiveBfoFrequency - cwPitch :
+								receiveBfoFrequency + cwPitch;
+}
+
+// Hz to the hundredths of Hz the Si5351 library counts in
+template <typename F>
+inline unsigned long long synthFrequency(F frequency) {
+	return (unsigned long long) frequency * 100ULL;
+}
+
+#endif
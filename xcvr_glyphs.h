@@ -0,0 +1,59 @@
+// Generated by tools/gen_glyphs.py from xcvr_fonts.h, do not edit.
+
+#ifndef xcvr_glyphs_h_
+#define xcvr_glyphs_h_
+
+// font_frequency at baseline 12: '0123456789. '
+#define FREQUENCY_GLYPHS_WIDTH 8
+#define FREQUENCY_GLYPHS_FIRST_PAGE 0
+#define FREQUENCY_GLYPHS_PAGES 2
+static const byte frequencyGlyphs[12][16] PROGMEM = {
+  {0xF0, 0xF8, 0x0C, 0x04, 0x0C, 0xF8, 0xF0, 0x00, 0x03, 0x07, 0x0C, 0x08, 0x0C, 0x07, 0x03, 0x00}, // '0'
+  {0x00, 0x10, 0x18, 0xFC, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x08, 0x08, 0x0F, 0x0F, 0x08, 0x08, 0x00}, // '1'
+  {0x18, 0x1C, 0x04, 0x84, 0xC4, 0x7C, 0x38, 0x00, 0x0C, 0x0E, 0x0B, 0x09, 0x08, 0x08, 0x08, 0x00}, // '2'
+  {0x04, 0x04, 0x44, 0x64, 0x74, 0xDC, 0x8C, 0x00, 0x04, 0x0C, 0x08, 0x08, 0x08, 0x0F, 0x07, 0x00}, // '3'
+  {0xC0, 0xE0, 0x30, 0x18, 0xFC, 0xFC, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x0F, 0x0F, 0x01, 0x00}, // '4'
+  {0x7C, 0x7C, 0x64, 0x24, 0x24, 0xE4, 0xC4, 0x00, 0x04, 0x0C, 0x08, 0x08, 0x08, 0x0F, 0x07, 0x00}, // '5'
+  {0xF0, 0xF8, 0xCC, 0x44, 0x44, 0xC4, 0x80, 0x00, 0x07, 0x0F, 0x0C, 0x08, 0x08, 0x0F, 0x07, 0x00}, // '6'
+  {0x04, 0x04, 0x04, 0xC4, 0xE4, 0x3C, 0x1C, 0x00, 0x00, 0x00, 0x0F, 0x0F, 0x00, 0x00, 0x00, 0x00}, // '7'
+  {0xB8, 0xFC, 0x44, 0x44, 0x44, 0xFC, 0xB8, 0x00, 0x07, 0x0F, 0x08, 0x08, 0x08, 0x0F, 0x07, 0x00}, // '8'
+  {0x78, 0xFC, 0x84, 0x84, 0xCC, 0xFC, 0xF8, 0x00, 0x00, 0x08, 0x08, 0x08, 0x0C, 0x07, 0x03, 0x00}, // '9'
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x0E, 0x0E, 0x04, 0x00, 0x00}, // '.'
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+};
+
+// font_ui at baseline 30: '0123456789'
+#define WPM_GLYPHS_WIDTH 6
+#define WPM_GLYPHS_FIRST_PAGE 2
+#define WPM_GLYPHS_PAGES 2
+static const byte wpmGlyphs[10][12] PROGMEM = {
+  {0x80, 0xC0, 0x40, 0xC0, 0x80, 0x00, 0x1F, 0x3F, 0x20, 0x3F, 0x1F, 0x00}, // '0'
+  {0x00, 0x80, 0xC0, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x3F, 0x3F, 0x00, 0x00}, // '1'
+  {0x80, 0xC0, 0x40, 0xC0, 0x80, 0x00, 0x30, 0x38, 0x2C, 0x27, 0x23, 0x00}, // '2'
+  {0x80, 0xC0, 0x40, 0xC0, 0x80, 0x00, 0x10, 0x30, 0x22, 0x3F, 0x1D, 0x00}, // '3'
+  {0x00, 0x00, 0x00, 0x80, 0xC0, 0x00, 0x0C, 0x0A, 0x09, 0x3F, 0x3F, 0x08}, // '4'
+  {0xC0, 0xC0, 0x40, 0x40, 0x40, 0x00, 0x1B, 0x33, 0x22, 0x3E, 0x1C, 0x00}, // '5'
+  {0x80, 0xC0, 0x40, 0xC0, 0x80, 0x00, 0x1F, 0x3F, 0x22, 0x3E, 0x1C, 0x00}, // '6'
+  {0x40, 0x40, 0x40, 0xC0, 0xC0, 0x00, 0x00, 0x38, 0x3E, 0x07, 0x01, 0x00}, // '7'
+  {0x80, 0xC0, 0x40, 0xC0, 0x80, 0x00, 0x1D, 0x3F, 0x22, 0x3F, 0x1D, 0x00}, // '8'
+  {0x80, 0xC0, 0x40, 0xC0, 0x80, 0x00, 0x13, 0x37, 0x24, 0x3F, 0x1F, 0x00}, // '9'
+};
+
+// font_ui at baseline 47: '0123456789'
+#define PITCH_GLYPHS_WIDTH 6
+#define PITCH_GLYPHS_FIRST_PAGE 4
+#define PITCH_GLYPHS_PAGES 2
+static const byte pitchGlyphs[10][12] PROGMEM = {
+  {0x00, 0x80, 0x80, 0x80, 0x00, 0x00, 0x3F, 0x7F, 0x40, 0x7F, 0x3F, 0x00}, // '0'
+  {0x00, 0x00, 0x80, 0x80, 0x00, 0x00, 0x00, 0x01, 0x7F, 0x7F, 0x00, 0x00}, // '1'
+  {0x00, 0x80, 0x80, 0x80, 0x00, 0x00, 0x61, 0x71, 0x58, 0x4F, 0x47, 0x00}, // '2'
+  {0x00, 0x80, 0x80, 0x80, 0x00, 0x00, 0x21, 0x61, 0x44, 0x7F, 0x3B, 0x00}, // '3'
+  {0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x18, 0x14, 0x12, 0x7F, 0x7F, 0x10}, // '4'
+  {0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x37, 0x67, 0x44, 0x7C, 0x38, 0x00}, // '5'
+  {0x00, 0x80, 0x80, 0x80, 0x00, 0x00, 0x3F, 0x7F, 0x44, 0x7D, 0x39, 0x00}, // '6'
+  {0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x00, 0x70, 0x7C, 0x0F, 0x03, 0x00}, // '7'
+  {0x00, 0x80, 0x80, 0x80, 0x00, 0x00, 0x3B, 0x7F, 0x44, 0x7F, 0x3B, 0x00}, // '8'
+  {0x00, 0x80, 0x80, 0x80, 0x00, 0x00, 0x27, 0x6F, 0x48, 0x7F, 0x3F, 0x00}, // '9'
+};
+
+#endif
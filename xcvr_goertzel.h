@@ -0,0 +1,76 @@
+#ifndef xcvr_goertzel_h_
+#define xcvr_goertzel_h_
+
+/**
+	Fixed point Goertzel arithmetic for the audio meter.
+
+	Coefficients are 2 * cos(w) in Q14, the filter state is 16 bit. Per sample and filter that is
+	one signed 16x16 bit multiply and a 14 bit shift of the product, which on AVR is done with the
+	hardware multiplier and by picking the product's bytes, around 30 cycles. Written in plain C
+	the compiler calls its 32 bit multiply and shifts the product in a 14 step loop.
+
+	This file has no Arduino dependencies so that tools/goertzel_test.cpp can run synthetic
+	sample streams through it on the host.
+ */
+
+#define METER_COEFFICIENT_BITS 14
+
+// ADC reading, 0..1023 around 512, to the filter input, +-64 so that a full scale tone at the
+// filter frequency stays within 16 bits over a block, down to the 150 Hz of the lowest pitch
+inline short goertzel_input(short value) {
+	return (value - 512) >> 3;
+}
+
+// (coefficient * state) >> METER_COEFFICIENT_BITS, cut to 16 bits
+inline short goertzel_product(short coefficient, short state) {
+	long product;
+#ifdef __AVR__
+	// signed 16x16 -> 32 bit multiply on the hardware multiplier, 20 cycles
+	asm volatile (
+		"clr r26 \n\t"
+		"mul %A1, %A2 \n\t"
+		"movw %A0, r0 \n\t"
+		"muls %B1, %B2 \n\t"
+		"movw %C0, r0 \n\t"
+		"mulsu %B2, %A1 \n\t"
+		"sbc %D0, r26 \n\t"
+		"add %B0, r0 \n\t"
+		"adc %C0, r1 \n\t"
+		"adc %D0, r26 \n\t"
+		"mulsu %B1, %A2 \n\t"
+		"sbc %D0, r26 \n\t"
+		"add %B0, r0 \n\t"
+		"adc %C0, r1 \n\t"
+		"adc %D0, r26 \n\t"
+		"clr r1 \n\t"
+		: "=&r" (product)
+		: "a" (coefficient), "a" (state)
+		: "r26");
+#else
+	product = (long) coefficient * state;
+#endif
+	// bits 14..29 from the product's bytes, a 32 bit shift by 14 is a loop on AVR
+	union {
+		long value;
+		unsigned char bytes[4];
+	} p;
+	p.value = product;
+	return (short) (((((unsigned short) p.bytes[3] << 8) | p.bytes[2]) << 2) | (p.bytes[1] >> 6));
+}
+
+// s = x + coefficient * s1 - s2
+inline void goertzel_step(short coefficient, short x, short& s1, short& s2) {
+	short s = x + goertzel_product(coefficient, s1) - s2;
+	s2 = s1;
+	s1 = s;
+}
+
+// the power at the filter frequency after a block, from the last two states; once per block,
+// so plain arithmetic, coefficient * s1 can take more than 16 bits here
+inline long goertzel_power(short coefficient, short s1, short s2) {
+	long cross = (((long) coefficient * s1) >> METER_COEFFICIENT_BITS) * s2;
+	long power = (long) s1 * s1 + (long) s2 * s2 - cross;
+	return power < 0 ? 0 : power; // rounding of the coefficient
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef xcvr_paddles_h_
+#define xcvr_paddles_h_
+
+/**
+	ULTIMATIC paddle state machine.
+
+	The keyer remembers which paddles it last saw closed. On every paddle check the state and the
+	dit and dah buffers give the next state and which buffer to drop, looked up in a PROGMEM table
+	that ULTIMATIC_TABLE() builds at compile time from ultimatic_transition(). In normal ultimatic
+	the paddle closed last wins a squeeze, from no closure the dit does. In the dit and dah
+	priority modes the state never changes and only the squeeze is resolved.
+
+	This file has no Arduino dependencies so that tools/paddle_table_test.cpp can check the table
+	against the original nested switch on the host.
+ */
+
+#define NO_CLOSURE 0
+#define DIT_CLOSURE_DAH_OFF 1
+#define DAH_CLOSURE_DIT_OFF 2
+#define DIT_CLOSURE_DAH_ON 3
+#define DAH_CLOSURE_DIT_ON 4
+#define CLOSURE_STATES 5
+
+#define ULTIMATIC_NORMAL 0
+#define ULTIMATIC_DIT_PRIORITY 1
+#define ULTIMATIC_DAH_PRIORITY 2
+#define ULTIMATIC_MODES 3
+
+#define CLOSURE_STATE_MASK 0x07
+#define CLOSURE_CLEAR_DIT 0x08
+#define CLOSURE_CLEAR_DAH 0x10
+
+// columns are the dit and dah buffers: both empty, dit only, dah only, both set
+#define CLOSURE_INDEX(state, dit, dah) (((state) << 2) | ((dah) << 1) | (dit))
+
+constexpr bool ultimatic_dah_wins(unsigned char state) {
+	return state == DIT_CLOSURE_DAH_OFF || state == DAH_CLOSURE_DIT_ON;
+}
+
+constexpr unsigned char ultimatic_transition(unsigned char mode, unsigned char state, bool dit, bool dah) {
+	return mode == ULTIMATIC_DIT_PRIORITY ? state | (dit && dah ? CLOSURE_CLEAR_DAH : 0)
+		: mode == ULTIMATIC_DAH_PRIORITY ? state | (dit && dah ? CLOSURE_CLEAR_DIT : 0)
+		: !dit && !dah ? NO_CLOSURE
+		: !dah ? DIT_CLOSURE_DAH_OFF
+		: !dit ? DAH_CLOSURE_DIT_OFF
+		: ultimatic_dah_wins(state) ? DAH_CLOSURE_DIT_ON | CLOSURE_CLEAR_DIT
+		: DIT_CLOSURE_DAH_ON | CLOSURE_CLEAR_DAH;
+}
+
+#define ULTIMATIC_ROW(mode, state) \
+	ultimatic_transition(mode, state, false, false), ultimatic_transition(mode, state, true, false), \
+	ultimatic_transition(mode, state, false, true), ultimatic_transition(mode, state, true, true)
+
+#define ULTIMATIC_TABLE(mode) { \
+	ULTIMATIC_ROW(mode, NO_CLOSURE), ULTIMATIC_ROW(mode, DIT_CLOSURE_DAH_OFF), \
+	ULTIMATIC_ROW(mode, DAH_CLOSURE_DIT_OFF), ULTIMATIC_ROW(mode, DIT_CLOSURE_DAH_ON), \
+	ULTIMATIC_ROW(mode, DAH_CLOSURE_DIT_ON) }
+
+#endif